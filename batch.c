@@ -0,0 +1,275 @@
+/* batch.c - batch conversion of many disk images
+
+    (C) 2026 mnib contributors
+
+    Inputs are given as image files, directories (all images with the
+    input extension) or @manifest files (one input per line, lines
+    starting with '#' are ignored).  All inputs are listed first, then
+    the images are converted in the same process by jobs, one image per
+    job (see jobs.c).  Under Linux several images are converted at once
+    and the result line of each image is printed when it is done, so the
+    lines may come in a different order than the inputs.  A summary is
+    printed at the end.
+
+    V 0.10   first version
+    V 0.11   added run_inputs() for images without an output file
+    V 0.12   images are converted by jobs, on all processors under Linux
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "jobs.h"
+
+
+struct batch_totals
+{
+    char **names;       /* images to convert */
+    int count, max_count;
+    char *out_ext;
+    batch_convert convert;
+    batch_process process;  /* set by run_inputs(), no output file */
+    int files;
+    int ok;
+    int errors;         /* converted, but with bad sectors or tracks */
+    int failed;
+};
+
+
+static void add_input(char *name, char *in_ext, struct batch_totals *totals);
+
+
+/* replace the extension of the file name (not the path) by ext */
+void make_output_name(char *inname, char *outname, char *ext)
+{
+    char *base, *dot;
+
+    strcpy(outname, inname);
+    dot = NULL;
+    for (base = outname; *base != '\0'; base++)
+    {
+        if ((*base == '/') || (*base == '\\') || (*base == ':'))
+            dot = NULL;
+        else if (*base == '.')
+            dot = base;
+    }
+    if (dot != NULL)
+        strcpy(dot, ext);
+    else
+        strcat(outname, ext);
+}
+
+
+static int has_extension(char *name, char *ext)
+{
+    int name_len, ext_len;
+    int i;
+
+    name_len = strlen(name);
+    ext_len = strlen(ext);
+    if (name_len <= ext_len) return (0);
+
+    for (i = 0; i < ext_len; i++)
+        if (tolower(name[name_len - ext_len + i]) != tolower(ext[i]))
+            return (0);
+    return (1);
+}
+
+
+/* append an image to the list of images to convert */
+static void add_name(char *name, struct batch_totals *totals)
+{
+    if (totals->count == totals->max_count)
+    {
+        totals->max_count = totals->max_count ? 2 * totals->max_count : 64;
+        totals->names = realloc(totals->names,
+                                totals->max_count * sizeof(char *));
+        if (totals->names == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit (-1);
+        }
+    }
+    totals->names[totals->count] = malloc(strlen(name) + 1);
+    if (totals->names[totals->count] == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit (-1);
+    }
+    strcpy(totals->names[totals->count], name);
+    totals->count++;
+}
+
+
+/* convert one image of the list, a job of run_jobs() */
+static void convert_one(void *context, int index)
+{
+    struct batch_totals *totals;
+    char outname[1024];
+    char *inname;
+    int errors;
+    int status;
+
+    totals = context;
+    inname = totals->names[index];
+    errors = 0;
+
+    if (totals->process != NULL)
+        status = totals->process(inname, &errors);
+    else
+    {
+        make_output_name(inname, outname, totals->out_ext);
+        status = totals->convert(inname, outname, &errors);
+    }
+
+    lock_jobs();
+    totals->files++;
+    if (status != 0)
+    {
+        totals->failed++;
+        printf("%-40s FAILED\n", inname);
+    }
+    else if (errors != 0)
+    {
+        totals->errors++;
+        printf("%-40s %d errors\n", inname, errors);
+    }
+    else
+    {
+        totals->ok++;
+        printf("%-40s OK\n", inname);
+    }
+    fflush(stdout);
+    unlock_jobs();
+}
+
+
+static int compare_names(const void *a, const void *b)
+{
+    return (strcmp(*(char **) a, *(char **) b));
+}
+
+
+/* list all images in a directory, in alphabetical order */
+static void add_dir(char *dirname, char *in_ext, struct batch_totals *totals)
+{
+    DIR *dir;
+    struct dirent *entry;
+    char *path;
+    int first;
+
+    dir = opendir(dirname);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Cannot open directory %s.\n", dirname);
+        totals->files++;
+        totals->failed++;
+        return;
+    }
+
+    first = totals->count;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (!has_extension(entry->d_name, in_ext)) continue;
+        path = malloc(strlen(dirname) + strlen(entry->d_name) + 2);
+        if (path == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            exit (-1);
+        }
+        sprintf(path, "%s/%s", dirname, entry->d_name);
+        add_name(path, totals);
+        free(path);
+    }
+    closedir(dir);
+
+    qsort(totals->names + first, totals->count - first, sizeof(char *),
+          compare_names);
+}
+
+
+/* list all inputs listed in a manifest file */
+static void add_manifest(char *listname, char *in_ext,
+                         struct batch_totals *totals)
+{
+    FILE *fp_list;
+    char line[1024];
+    int len;
+
+    fp_list = fopen(listname, "r");
+    if (fp_list == NULL)
+    {
+        fprintf(stderr, "Cannot open manifest %s.\n", listname);
+        totals->files++;
+        totals->failed++;
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp_list) != NULL)
+    {
+        for (len = strlen(line); (len > 0) && isspace(line[len-1]); len--);
+        line[len] = '\0';
+        if ((len == 0) || (line[0] == '#') || (line[0] == '@')) continue;
+
+        add_input(line, in_ext, totals);
+    }
+    fclose(fp_list);
+}
+
+
+static void add_input(char *name, char *in_ext, struct batch_totals *totals)
+{
+    struct stat st;
+
+    if (name[0] == '@')
+        add_manifest(name+1, in_ext, totals);
+    else if ((stat(name, &st) == 0) && S_ISDIR(st.st_mode))
+        add_dir(name, in_ext, totals);
+    else
+        add_name(name, totals);
+}
+
+
+static int run_all(int argc, char **argv, char *in_ext, char *out_ext,
+                   batch_convert convert, batch_process process)
+{
+    struct batch_totals totals;
+    int i;
+
+    memset(&totals, 0, sizeof(totals));
+    totals.out_ext = out_ext;
+    totals.convert = convert;
+    totals.process = process;
+    for (i = 0; i < argc; i++)
+        add_input(argv[i], in_ext, &totals);
+
+    run_jobs(totals.count, convert_one, &totals);
+    for (i = 0; i < totals.count; i++) free(totals.names[i]);
+    free(totals.names);
+
+    printf("\n%d images: %d OK, %d with errors, %d failed\n",
+           totals.files, totals.ok, totals.errors, totals.failed);
+
+    return ((totals.failed == 0) ? 0 : -1);
+}
+
+
+/* convert all images given by argv[0..argc-1], see above
+   Returns 0 if all images could be converted, -1 otherwise. */
+int run_batch(int argc, char **argv, char *in_ext, char *out_ext,
+              batch_convert convert)
+{
+    return (run_all(argc, argv, in_ext, out_ext, convert, NULL));
+}
+
+
+/* the same for a tool that reads the images only
+   Returns 0 if all images could be processed, -1 otherwise. */
+int run_inputs(int argc, char **argv, char *in_ext, batch_process process)
+{
+    return (run_all(argc, argv, in_ext, NULL, NULL, process));
+}
@@ -0,0 +1,29 @@
+/* batch.h - batch conversion of many disk images
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version
+    V 0.11   added run_inputs() for images without an output file
+*/
+
+#ifndef _BATCH_
+#define _BATCH_
+
+
+/* convert one image, returns 0 on success or -1 if it failed,
+   *errors is set to the number of bad sectors or tracks */
+typedef int (*batch_convert)(char *inname, char *outname, int *errors);
+
+/* the same for a tool that reads the image only */
+typedef int (*batch_process)(char *inname, int *errors);
+
+
+void make_output_name(char *inname, char *outname, char *ext);
+
+int run_batch(int argc, char **argv, char *in_ext, char *out_ext,
+              batch_convert convert);
+
+int run_inputs(int argc, char **argv, char *in_ext, batch_process process);
+
+
+#endif
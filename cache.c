@@ -0,0 +1,252 @@
+/* cache.c - cache of per-track conversion results
+
+    (C) 2026 mnib contributors
+
+    The converters keep the result of each track in a cache directory,
+    so converting an archive again only has to do the tracks that
+    changed.  The key of a result is made from the converter name and
+    version, the versions of the conversion routines, the options and
+    the GCR data of the track, see start_cache_key().  If any of these
+    changes, the key changes and the track is converted again.
+
+    CACHE.DAT   "MNIB-CACHE" header, then each result as two DWORD key
+                hashes, a length word and the result data
+
+    The file is only appended to.  All keys are read into a hash table
+    when the cache is opened.  Keys are two independent 32 bit hashes,
+    so different tracks getting the same key is not to be expected
+    even for large archives.
+
+    V 0.10   first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+
+#define RECORD_HEADER_SIZE 10
+
+
+static DWORD get_dword(BYTE *ptr)
+{
+    return (ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((DWORD) ptr[3] << 24));
+}
+
+
+static void put_dword(BYTE *ptr, DWORD value)
+{
+    ptr[0] = value & 0xff;
+    ptr[1] = (value >> 8) & 0xff;
+    ptr[2] = (value >> 16) & 0xff;
+    ptr[3] = (value >> 24) & 0xff;
+}
+
+
+/* put an entry into the hash table, growing it if needed */
+static int insert_entry(struct result_cache *cache, DWORD *key,
+                        DWORD offset, int len)
+{
+    int *table;
+    int size;
+    int i, slot;
+
+    if (cache->entries == cache->max_entries)
+    {
+        cache->max_entries = cache->max_entries ? 2 * cache->max_entries
+                                                : 1024;
+        cache->entry = realloc(cache->entry,
+                               cache->max_entries * sizeof(struct cache_entry));
+        if (cache->entry == NULL) return (0);
+
+        for (size = 1; size < 2 * cache->max_entries; size *= 2);
+        table = calloc(size, sizeof(int));
+        if (table == NULL) return (0);
+        free(cache->table);
+        cache->table = table;
+        cache->table_size = size;
+
+        for (i = 0; i < cache->entries; i++)
+        {
+            slot = cache->entry[i].key[0] & (size - 1);
+            while (table[slot] != 0) slot = (slot + 1) & (size - 1);
+            table[slot] = i + 1;
+        }
+    }
+
+    cache->entry[cache->entries].key[0] = key[0];
+    cache->entry[cache->entries].key[1] = key[1];
+    cache->entry[cache->entries].offset = offset;
+    cache->entry[cache->entries].len = len;
+
+    slot = key[0] & (cache->table_size - 1);
+    while (cache->table[slot] != 0)
+        slot = (slot + 1) & (cache->table_size - 1);
+    cache->table[slot] = ++cache->entries;
+    return (1);
+}
+
+
+/* open or create the cache in directory dir
+   Returns 1 on success, 0 on failure. */
+int open_cache(struct result_cache *cache, char *dir)
+{
+    BYTE header[CACHE_HEADER_SIZE];
+    BYTE record[RECORD_HEADER_SIZE];
+    char path[1024];
+    DWORD key[2];
+    long pos;
+    int len;
+
+    memset(cache, 0, sizeof(struct result_cache));
+
+    sprintf(path, "%s/CACHE.DAT", dir);
+    cache->fp = fopen(path, "r+b");
+    if (cache->fp == NULL) cache->fp = fopen(path, "w+b");
+    if (cache->fp == NULL)
+    {
+        fprintf(stderr, "Cannot open cache %s.\n", path);
+        return (0);
+    }
+
+    fseek(cache->fp, 0, SEEK_END);
+    cache->size = ftell(cache->fp);
+    if (cache->size == 0)
+    {
+        memset(header, 0, sizeof(header));
+        memcpy(header, CACHE_MAGIC, strlen(CACHE_MAGIC));
+        if (fwrite((char *) header, sizeof(header), 1, cache->fp) != 1)
+        {
+            fprintf(stderr, "Cannot write cache header.\n");
+            close_cache(cache);
+            return (0);
+        }
+        cache->size = sizeof(header);
+        return (1);
+    }
+
+    fseek(cache->fp, 0, SEEK_SET);
+    if ((fread(header, sizeof(header), 1, cache->fp) != 1)
+        || (memcmp(header, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0))
+    {
+        fprintf(stderr, "%s is not a result cache.\n", path);
+        close_cache(cache);
+        return (0);
+    }
+
+    /* a result not completely written ends the cache */
+    for (pos = sizeof(header); pos + RECORD_HEADER_SIZE <= cache->size; )
+    {
+        fseek(cache->fp, pos, SEEK_SET);
+        if (fread(record, RECORD_HEADER_SIZE, 1, cache->fp) != 1) break;
+        key[0] = get_dword(record);
+        key[1] = get_dword(record + 4);
+        len = record[8] | (record[9] << 8);
+        if (pos + RECORD_HEADER_SIZE + len > cache->size) break;
+
+        if (!insert_entry(cache, key, pos + RECORD_HEADER_SIZE, len))
+        {
+            fprintf(stderr, "Out of memory reading cache.\n");
+            close_cache(cache);
+            return (0);
+        }
+        pos += RECORD_HEADER_SIZE + len;
+    }
+    cache->size = pos;
+    return (1);
+}
+
+
+void close_cache(struct result_cache *cache)
+{
+    if (cache->fp != NULL) fclose(cache->fp);
+    free(cache->entry);
+    free(cache->table);
+    memset(cache, 0, sizeof(struct result_cache));
+}
+
+
+/* start a key with the converter, its version, the versions of the
+   conversion routines it uses and its options, as one string */
+void start_cache_key(DWORD *key, char *converter)
+{
+    key[0] = 2166136261U;
+    key[1] = 5381;
+    add_cache_key(key, (BYTE *) converter, strlen(converter) + 1);
+}
+
+
+/* add data to a key: FNV-1a and Bernstein hash */
+void add_cache_key(DWORD *key, BYTE *data, int len)
+{
+    DWORD h0, h1;
+    int i;
+
+    h0 = key[0];
+    h1 = key[1];
+    for (i = 0; i < len; i++)
+    {
+        h0 = (h0 ^ data[i]) * 16777619U;
+        h1 = (h1 * 33) ^ data[i];
+    }
+    key[0] = h0;
+    key[1] = h1;
+}
+
+
+/* look up a result, returns its length, -1 if it is not cached
+   or longer than max_len */
+int find_cached(struct result_cache *cache, DWORD *key,
+                BYTE *result, int max_len)
+{
+    struct cache_entry *entry;
+    int slot;
+
+    if (cache->entries == 0) return (-1);
+
+    slot = key[0] & (cache->table_size - 1);
+    for ( ; cache->table[slot] != 0;
+         slot = (slot + 1) & (cache->table_size - 1))
+    {
+        entry = &cache->entry[cache->table[slot] - 1];
+        if ((entry->key[0] != key[0]) || (entry->key[1] != key[1]))
+            continue;
+
+        if (entry->len > max_len) return (-1);
+        if ((fseek(cache->fp, entry->offset, SEEK_SET) != 0)
+            || ((entry->len > 0)
+                && (fread(result, entry->len, 1, cache->fp) != 1)))
+            return (-1);
+        return (entry->len);
+    }
+    return (-1);
+}
+
+
+/* add a result to the cache, returns 1 on success, 0 on failure */
+int store_cached(struct result_cache *cache, DWORD *key,
+                 BYTE *result, int len)
+{
+    BYTE record[RECORD_HEADER_SIZE];
+
+    if (len > CACHE_MAX_RESULT) return (0);
+
+    put_dword(record, key[0]);
+    put_dword(record + 4, key[1]);
+    record[8] = len % 256;
+    record[9] = len / 256;
+
+    fseek(cache->fp, cache->size, SEEK_SET);
+    if ((fwrite((char *) record, RECORD_HEADER_SIZE, 1, cache->fp) != 1)
+        || ((len > 0) && (fwrite((char *) result, len, 1, cache->fp) != 1)))
+    {
+        fprintf(stderr, "Cannot write to cache.\n");
+        return (0);
+    }
+
+    if (!insert_entry(cache, key, cache->size + RECORD_HEADER_SIZE, len))
+        return (0);
+    cache->size += RECORD_HEADER_SIZE + len;
+    return (1);
+}
@@ -0,0 +1,55 @@
+/* cache.h - cache of per-track conversion results
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version
+*/
+
+#ifndef _CACHE_
+#define _CACHE_
+
+#include <stdio.h>
+#include "gcr.h"
+
+
+#define CACHE_MAGIC "MNIB-CACHE"
+#define CACHE_HEADER_SIZE 16
+#define CACHE_MAX_RESULT 0x2000     /* largest cached result */
+
+
+/* a cached result in CACHE.DAT */
+struct cache_entry
+{
+    DWORD key[2];
+    DWORD offset;       /* offset of the result in CACHE.DAT */
+    int len;
+};
+
+/* an open result cache, see open_cache() */
+struct result_cache
+{
+    FILE *fp;
+    long size;          /* size of CACHE.DAT */
+    struct cache_entry *entry;
+    int entries, max_entries;
+    int *table;         /* hash table of entry numbers + 1, 0 = empty */
+    int table_size;     /* a power of 2, at least 2 * max_entries */
+};
+
+
+int open_cache(struct result_cache *cache, char *dir);
+
+void close_cache(struct result_cache *cache);
+
+void start_cache_key(DWORD *key, char *converter);
+
+void add_cache_key(DWORD *key, BYTE *data, int len);
+
+int find_cached(struct result_cache *cache, DWORD *key,
+                BYTE *result, int max_len);
+
+int store_cached(struct result_cache *cache, DWORD *key,
+                 BYTE *result, int len);
+
+
+#endif
@@ -7,6 +7,7 @@
  *  Copyright 1999 Michael Klein <michael.klein@puffin.lb.shuttle.de>
 */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -15,6 +16,109 @@
 
 const char cbm_dev[] = "/dev/cbm";
 
+/*
+ *  all drive I/O goes through the selected transport
+ */
+static struct cbm_transport *transports[] = {
+#if defined(__DJGPP__) || defined(__linux__)
+    &lpt_transport,
+#endif
+    &sim_transport,
+    &pipe_transport,
+    NULL
+};
+
+static struct cbm_transport *transport = NULL;
+static char transport_arg[256];
+
+/* select a transport by "name" or "name:arg", returns 0 if unknown */
+int cbm_set_transport(char *spec)
+{
+    int i, len;
+    char *colon;
+
+    colon = strchr(spec, ':');
+    len = (colon != NULL) ? colon - spec : strlen(spec);
+
+    for(i = 0; transports[i] != NULL; i++) {
+        if((strlen(transports[i]->name) == len) &&
+           (strncmp(transports[i]->name, spec, len) == 0)) {
+            transport = transports[i];
+            transport_arg[0] = '\0';
+            if(colon != NULL) {
+                strncpy(transport_arg, colon+1, sizeof(transport_arg)-1);
+                transport_arg[sizeof(transport_arg)-1] = '\0';
+            }
+            return 1;
+        }
+    }
+    fprintf(stderr, "Unknown transport %s, use one of:", spec);
+    for(i = 0; transports[i] != NULL; i++) {
+        fprintf(stderr, " %s", transports[i]->name);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+/* find the drive, the first transport is the default */
+int cbm_init(int reset)
+{
+    if(transport == NULL) {
+        transport = transports[0];
+    }
+    return transport->init(reset, transport_arg);
+}
+
+int cbm_set_par_port(int port)
+{
+    return transport->set_par_port(port);
+}
+
+int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
+{
+    return transport->ioctl(f, cmd, arg);
+}
+
+int cbm_read(int f, char *buf, int count)
+{
+    return transport->read(f, buf, count);
+}
+
+int cbm_write(int f, char *buf, int count)
+{
+    return transport->write(f, buf, count);
+}
+
+int cbm_nib_read1(int f)
+{
+    return transport->nib_read1(f);
+}
+
+int cbm_nib_read2(int f)
+{
+    return transport->nib_read2(f);
+}
+
+int cbm_nib_read_track(int f, __u_char *buf, int count)
+{
+    return transport->nib_read_track(f, buf, count);
+}
+
+void cbm_delay(int msec)
+{
+    transport->delay(msec);
+}
+
+void cbm_disable(void)
+{
+    transport->disable();
+}
+
+void cbm_enable(void)
+{
+    transport->enable();
+}
+
 int cbm_listen(int f, __u_char dev, __u_char secadr)
 {
     return cbm_ioctl(f, CBMCTRL_LISTEN, (dev<<8) | secadr);
@@ -37,22 +141,22 @@ int cbm_close(int f, __u_char dev, __u_char secadr)
 
 int cbm_unlisten(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_UNLISTEN);
+    return cbm_ioctl(f, CBMCTRL_UNLISTEN, 0);
 }
 
 int cbm_untalk(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_UNTALK);
+    return cbm_ioctl(f, CBMCTRL_UNTALK, 0);
 }
 
 int cbm_reset(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_RESET);
+    return cbm_ioctl(f, CBMCTRL_RESET, 0);
 }
 
 __u_char cbm_pp_read(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_PP_READ);
+    return cbm_ioctl(f, CBMCTRL_PP_READ, 0);
 }
 
 void cbm_pp_write(int f, __u_char c)
@@ -62,7 +166,7 @@ void cbm_pp_write(int f, __u_char c)
 
 __u_char cbm_par_read(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_PAR_READ);
+    return cbm_ioctl(f, CBMCTRL_PAR_READ, 0);
 }
 
 void cbm_par_write(int f, __u_char c)
@@ -72,12 +176,12 @@ void cbm_par_write(int f, __u_char c)
 
 int cbm_iec_poll(int f)
 {
-    return cbm_ioctl(f, CBMCTRL_IEC_POLL);
+    return cbm_ioctl(f, CBMCTRL_IEC_POLL, 0);
 }
 
 int cbm_iec_get(int f, int line)
 {
-    return (cbm_ioctl(f, CBMCTRL_IEC_POLL) & line) != 0;
+    return (cbm_ioctl(f, CBMCTRL_IEC_POLL, 0) & line) != 0;
 }
 
 void cbm_iec_set(int f, int line)
@@ -10,6 +10,8 @@
 #ifndef _CBM_H
 #define _CBM_H
 
+#include <stdio.h>
+
 #define IEC_DATA   0x01
 #define IEC_CLOCK  0x02
 #define IEC_ATN    0x04
@@ -17,8 +19,60 @@
 #define __u_char unsigned char
 
 
+/*
+ *  drive connection, see cbm_set_transport()
+ *
+ *  init() finds the drive (reset: reset the drives first), arg is the
+ *  text behind the ':' of the transport name.  ioctl() takes the
+ *  CBMCTRL_ commands of kernel.h.  nib_read_track() reads count bytes
+ *  of a track transfer, it returns the number read before a timeout.
+ *  delay() waits msec milliseconds, disable()/enable() lock out
+ *  interrupts during nibble transfers.
+ */
+struct cbm_transport
+{
+    char *name;
+    int (*init)(int reset, char *arg);
+    int (*set_par_port)(int port);
+    int (*ioctl)(int f, unsigned int cmd, unsigned long arg);
+    int (*read)(int f, char *buf, int count);
+    int (*write)(int f, char *buf, int count);
+    int (*nib_read1)(int f);
+    int (*nib_read2)(int f);
+    int (*nib_read_track)(int f, __u_char *buf, int count);
+    void (*delay)(int msec);
+    void (*disable)(void);
+    void (*enable)(void);
+};
+
+#if defined(__DJGPP__) || defined(__linux__)
+extern struct cbm_transport lpt_transport;     /* kernel.c: XE1541 cable */
+#endif
+extern struct cbm_transport sim_transport;     /* simdrive.c: image file */
+extern struct cbm_transport pipe_transport;    /* cbmpipe.c: cbmserve */
+
+extern int serve_transport(struct cbm_transport *t, char *arg,
+                           FILE *fp_in, FILE *fp_out);
+
+
 extern const char cbm_dev[];
 
+extern int cbm_set_transport(char *spec);
+extern int cbm_init(int reset);
+extern int cbm_set_par_port(int port);
+
+extern int cbm_ioctl(int f, unsigned int cmd, unsigned long arg);
+extern int cbm_read(int f, char *buf, int count);
+extern int cbm_write(int f, char *buf, int count);
+extern int cbm_nib_read1(int f);
+extern int cbm_nib_read2(int f);
+extern int cbm_nib_read_track(int f, __u_char *buf, int count);
+
+extern void cbm_delay(int msec);
+extern void cbm_disable(void);
+extern void cbm_enable(void);
+extern unsigned long cbm_msec(void);           /* kernel.c: wall clock */
+
 extern int cbm_listen(int f, __u_char dev, __u_char secadr);
 extern int cbm_talk(int f, __u_char dev, __u_char secadr);
 
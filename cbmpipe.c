@@ -0,0 +1,285 @@
+/* cbmpipe.c - cbm transport through a pair of pipes
+
+    (C) 2026 mnib contributors
+
+    The pipe transport sends every drive operation to another process
+    and waits for its answer, that process runs the real transport with
+    serve_transport().  cbmserve does this for any transport:
+
+        mkfifo to_drive from_drive
+        cbmserve sim:image.g64 to_drive from_drive &
+        mnib -tpipe:to_drive,from_drive output.nib
+
+    Named pipes or anything that connects two files works, for example
+    socat for a socket to a machine with a drive attached.
+
+    Requests are one operation byte and its arguments, answers follow
+    right away.  All numbers are little endian.
+
+        'O' reset                       -> result byte
+        'P' port                        -> result byte
+        'C' command, arg (DWORD)        -> result (DWORD)
+        'R' count (WORD)                -> length (WORD), bytes
+        'W' count (WORD), bytes         -> result (WORD)
+        '1', '2'                        -> byte or $ffff (WORD)
+        'T' count (WORD)                -> length (WORD), bytes
+        'D' msec (WORD)                 -> no answer
+
+    The server locks interrupts while it reads a track for 'T', single
+    nibble bytes ('1', '2') are read without.
+
+    V 0.10   first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbm.h"
+#include "gcr.h"
+
+
+static FILE *fp_request;
+static FILE *fp_answer;
+
+
+static void put_value(FILE *fp, DWORD value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        fputc((value >> (8*i)) & 0xff, fp);
+}
+
+
+/* read a little endian value, -1 at end of file */
+static long get_value(FILE *fp, int bytes)
+{
+    DWORD value;
+    int i, c;
+
+    for (value = 0, i = 0; i < bytes; i++)
+    {
+        if ((c = fgetc(fp)) == EOF) return (-1);
+        value |= (DWORD) c << (8*i);
+    }
+    return (value);
+}
+
+
+/* send a request and wait for the answer of answer_bytes bytes,
+   op -1 finishes a request already started */
+static long request(int op, DWORD arg, int arg_bytes, int answer_bytes)
+{
+    if (op >= 0) fputc(op, fp_request);
+    put_value(fp_request, arg, arg_bytes);
+    fflush(fp_request);
+    if (answer_bytes == 0) return (0);
+    return (get_value(fp_answer, answer_bytes));
+}
+
+
+static int pipe_init(int reset, char *arg)
+{
+    char *comma;
+
+    comma = strchr(arg, ',');
+    if (comma == NULL)
+    {
+        fprintf(stderr, "Use -tpipe:requestfile,answerfile.\n");
+        return (0);
+    }
+    *comma = '\0';
+
+    fp_request = fopen(arg, "wb");
+    if (fp_request == NULL)
+    {
+        fprintf(stderr, "Cannot open request pipe %s.\n", arg);
+        return (0);
+    }
+    fp_answer = fopen(comma + 1, "rb");
+    if (fp_answer == NULL)
+    {
+        fprintf(stderr, "Cannot open answer pipe %s.\n", comma + 1);
+        return (0);
+    }
+
+    printf("Drive connected through %s, %s\n", arg, comma + 1);
+    return (request('O', reset, 1, 1) == 1);
+}
+
+
+static int pipe_set_par_port(int port)
+{
+    if (request('P', port, 1, 1) != 1) return (0);
+    printf("Port %d: pipe ", port);
+    return (1);
+}
+
+
+static int pipe_ioctl(int f, unsigned int cmd, unsigned long arg)
+{
+    fputc('C', fp_request);
+    put_value(fp_request, cmd, 1);
+    return ((int) request(-1, arg, 4, 4));
+}
+
+
+static int pipe_read(int f, char *buf, int count)
+{
+    long len;
+
+    len = request('R', count, 2, 2);
+    if ((len <= 0) || (len > count)) return (0);
+    return (fread(buf, 1, len, fp_answer));
+}
+
+
+static int pipe_write(int f, char *buf, int count)
+{
+    long rv;
+
+    fputc('W', fp_request);
+    put_value(fp_request, count, 2);
+    fwrite(buf, 1, count, fp_request);
+    rv = request(-1, 0, 0, 2);
+    return ((rv & 0x8000) ? (int) rv - 0x10000 : (int) rv);
+}
+
+
+static int pipe_nib_read(int op)
+{
+    long rv;
+
+    rv = request(op, 0, 0, 2);
+    return (((rv < 0) || (rv > 0xff)) ? -1 : (int) rv);
+}
+
+
+static int pipe_nib_read1(int f)
+{
+    return (pipe_nib_read('1'));
+}
+
+
+static int pipe_nib_read2(int f)
+{
+    return (pipe_nib_read('2'));
+}
+
+
+/* a whole track in one round trip */
+static int pipe_nib_read_track(int f, __u_char *buf, int count)
+{
+    long len;
+
+    len = request('T', count, 2, 2);
+    if ((len <= 0) || (len > count)) return (0);
+    return (fread(buf, 1, len, fp_answer));
+}
+
+
+static void pipe_delay(int msec)
+{
+    request('D', msec, 2, 0);
+}
+
+
+static void pipe_nothing(void)
+{
+}
+
+
+struct cbm_transport pipe_transport =
+{
+    "pipe",
+    pipe_init,
+    pipe_set_par_port,
+    pipe_ioctl,
+    pipe_read,
+    pipe_write,
+    pipe_nib_read1,
+    pipe_nib_read2,
+    pipe_nib_read_track,
+    pipe_delay,
+    pipe_nothing,
+    pipe_nothing
+};
+
+
+/* answer the requests from fp_in with transport t until end of file
+   Returns 0 at the end of the requests, -1 on a broken request. */
+int serve_transport(struct cbm_transport *t, char *arg,
+                    FILE *fp_in, FILE *fp_out)
+{
+    static BYTE track[GCR_TRACK_LENGTH];
+    char buf[0x100];
+    long cmd, value, count;
+    int op, rv;
+
+    while ((op = fgetc(fp_in)) != EOF)
+    {
+        switch (op)
+        {
+            case 'O':
+                if ((value = get_value(fp_in, 1)) < 0) return (-1);
+                put_value(fp_out, t->init(value, arg) ? 1 : 0, 1);
+                break;
+
+            case 'P':
+                if ((value = get_value(fp_in, 1)) < 0) return (-1);
+                put_value(fp_out, t->set_par_port(value) ? 1 : 0, 1);
+                break;
+
+            case 'C':
+                if (((cmd = get_value(fp_in, 1)) < 0)
+                    || ((value = get_value(fp_in, 4)) < 0))
+                    return (-1);
+                put_value(fp_out, t->ioctl(1, cmd, value), 4);
+                break;
+
+            case 'R':
+                if ((count = get_value(fp_in, 2)) < 0) return (-1);
+                if (count > sizeof(buf)) count = sizeof(buf);
+                rv = t->read(1, buf, count);
+                if (rv < 0) rv = 0;
+                put_value(fp_out, rv, 2);
+                fwrite(buf, 1, rv, fp_out);
+                break;
+
+            case 'W':
+                if ((count = get_value(fp_in, 2)) < 0) return (-1);
+                if ((count > sizeof(buf))
+                    || (fread(buf, 1, count, fp_in) != count))
+                    return (-1);
+                put_value(fp_out, t->write(1, buf, count), 2);
+                break;
+
+            case '1':
+            case '2':
+                rv = (op == '1') ? t->nib_read1(1) : t->nib_read2(1);
+                put_value(fp_out, (rv < 0) ? 0xffff : rv, 2);
+                break;
+
+            case 'T':
+                if ((count = get_value(fp_in, 2)) < 0) return (-1);
+                if (count > sizeof(track)) count = sizeof(track);
+                t->disable();
+                rv = t->nib_read_track(1, track, count);
+                t->enable();
+                if (rv < 0) rv = 0;
+                put_value(fp_out, rv, 2);
+                fwrite(track, 1, rv, fp_out);
+                break;
+
+            case 'D':
+                if ((value = get_value(fp_in, 2)) < 0) return (-1);
+                t->delay(value);
+                continue;
+
+            default:
+                return (-1);
+        }
+        fflush(fp_out);
+    }
+    return (0);
+}
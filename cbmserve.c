@@ -0,0 +1,94 @@
+/* cbmserve - serves a drive transport to mnib -tpipe
+
+    (C) 2026 mnib contributors
+
+    cbmserve answers the requests of the pipe transport with any other
+    transport, see cbmpipe.c:
+
+        mkfifo to_drive from_drive
+        cbmserve sim:image.g64 to_drive from_drive &
+        mnib -tpipe:to_drive,from_drive output.nib
+
+    V 0.10   first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbm.h"
+
+#define VERSION 0.10
+
+
+static struct cbm_transport *serve_list[] =
+{
+#if defined(__DJGPP__) || defined(__linux__)
+    &lpt_transport,
+#endif
+    &sim_transport,
+    NULL
+};
+
+
+void usage(void)
+{
+    int i;
+
+    fprintf(stderr, "Usage: cbmserve transport[:arg] requests answers\n"
+                    " transport:");
+    for (i = 0; serve_list[i] != NULL; i++)
+        fprintf(stderr, " %s", serve_list[i]->name);
+    fprintf(stderr, "\n");
+    exit (-1);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct cbm_transport *t;
+    FILE *fp_in, *fp_out;
+    char arg[256];
+    char *colon;
+    int len, i, rv;
+
+    if (argc != 4) usage();
+
+    colon = strchr(argv[1], ':');
+    len = (colon != NULL) ? colon - argv[1] : strlen(argv[1]);
+    for (t = NULL, i = 0; serve_list[i] != NULL; i++)
+    {
+        if ((strlen(serve_list[i]->name) == len)
+            && (strncmp(serve_list[i]->name, argv[1], len) == 0))
+            t = serve_list[i];
+    }
+    if (t == NULL) usage();
+
+    arg[0] = '\0';
+    if (colon != NULL)
+    {
+        strncpy(arg, colon + 1, sizeof(arg) - 1);
+        arg[sizeof(arg) - 1] = '\0';
+    }
+
+    /* the same order as the pipe transport opens them */
+    fp_in = fopen(argv[2], "rb");
+    if (fp_in == NULL)
+    {
+        fprintf(stderr, "Cannot open request pipe %s.\n", argv[2]);
+        exit (2);
+    }
+    fp_out = fopen(argv[3], "wb");
+    if (fp_out == NULL)
+    {
+        fprintf(stderr, "Cannot open answer pipe %s.\n", argv[3]);
+        exit (2);
+    }
+
+    fprintf(stderr, "cbmserve v%.2f: serving %s\n", VERSION, t->name);
+    rv = serve_transport(t, arg, fp_in, fp_out);
+    if (rv < 0) fprintf(stderr, "Broken request, stopped.\n");
+
+    fclose(fp_in);
+    fclose(fp_out);
+    return (rv < 0) ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+/* extract.c - extraction of track cycles from mnib nibbler data
+
+    (C) 2000,01 Markus Brenner <markus@brenner.de>
+
+    Based on code by Andreas Boose <boose@unixserv.rz.fh-hannover.de>
+
+    V 0.10   moved from n2g.c, used by n2g and nibstore
+    V 0.11   extract_track() keeps its sync list on the stack, tracks can
+             be extracted by several threads at once
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcr.h"
+#include "extract.h"
+
+
+int extract_verbose = 1;    /* print cycle position while extracting */
+
+
+
+int is_sector_zero(BYTE *data)
+{
+    if ((data[0] == 0x52)
+        && ((data[2] & 0x0f) == 0x05)
+        && ((data[3] & 0xfc) == 0x28))
+         return (1);
+    else return (0);
+}
+
+
+BYTE *check_vmax(BYTE *mnib_track)
+{
+    static BYTE vmax_track[GCR_TRACK_LENGTH+0x100];
+    BYTE *source, *dest;
+    int isvmax;
+    BYTE current, pilot;
+
+
+    isvmax=0;
+    pilot = 0;
+    for(source = mnib_track, dest = vmax_track; source < mnib_track+GCR_TRACK_LENGTH; source++)
+    {
+        current = *source;
+        if (current == 0x49)
+        {
+            if (pilot == 0)
+                *dest++ = 0xff; /* insert Sync byte */
+            pilot++;
+        }
+        else if ((current == 0xee) && (pilot > 5))
+        {
+            isvmax++;
+        }
+        else pilot = 0;
+
+        *dest++ = *source;
+    }
+
+
+    if (isvmax >= 5)
+    {
+        if (extract_verbose) printf("v-max!");
+        return (vmax_track+1); /* skip 1st $ff byte */
+    }
+    else
+        return mnib_track;
+}
+
+
+/* 7 bytes of GCR data as one number, positions too close to the end of
+   the track get a number of their own that matches nothing else */
+static QWORD sync_key(BYTE *mnib_track, int pos)
+{
+    QWORD key;
+    int i;
+
+    if (pos + 7 > GCR_TRACK_LENGTH) return (((QWORD) 1 << 63) | pos);
+
+    for (key = 0, i = 0; i < 7; i++)
+        key = (key << 8) | mnib_track[pos + i];
+    return (key);
+}
+
+
+/* extract one track cycle, starting behind the longest gap
+
+   All sync ends are collected in a single pass over the track.  The
+   cycle ends at the first sync end behind 0x1780 where the blocks of
+   the track start repeat: the first 7 bytes behind the track start and
+   behind each following sync must match those behind the syncs from
+   the candidate on, up to the end of the track.  With the 7 bytes of
+   each block as one number this is a period of the list of blocks,
+   which the Z algorithm finds for all candidates at once.
+   The track is started at the sync in front of the longest block up to
+   the cycle end, or at sector 0 if its block is not much shorter.
+   Cycles of 7900 bytes and more are killer tracks, these are copied
+   from the track start as a 7900 byte track.
+   Returns the cycle length, 0 if no cycle was found.
+*/
+DWORD extract_track(BYTE *mnib_track, BYTE *gcr_track)
+{
+    int sync[MAX_SYNCS];            /* sync ends */
+    QWORD key[MAX_SYNCS+1];         /* track start and each sync end */
+    int z[MAX_SYNCS+1];             /* matching keys at each key offset */
+    int syncs, valid;
+    int pos, start;
+    int block_len, max_block_len;
+    int sector_zero_len;
+    int cycle, cyclelen;
+    int reason;
+    int left, right;
+    int i;
+
+    /* find all sync ends */
+    syncs = 0;
+    for (pos = 0; ; )
+    {
+        while ((pos < GCR_TRACK_LENGTH) && (mnib_track[pos] != 0xff)) pos++;
+        while ((pos < GCR_TRACK_LENGTH) && (mnib_track[pos] == 0xff)) pos++;
+        if (pos >= GCR_TRACK_LENGTH) break;
+        sync[syncs++] = pos;
+    }
+
+    /* syncs with a complete header behind them */
+    for (valid = 0; (valid < syncs) && (sync[valid]+10 <= GCR_TRACK_LENGTH);
+         valid++);
+
+    key[0] = sync_key(mnib_track, 0);
+    for (i = 0; i < syncs; i++)
+        key[i+1] = sync_key(mnib_track, sync[i]);
+
+    /* z[d] = number of keys from d on that match the keys from 0 on */
+    z[0] = syncs+1;
+    for (left = right = 0, i = 1; i <= syncs; i++)
+    {
+        z[i] = (i < right) ? z[i-left] : 0;
+        if (i + z[i] > right) z[i] = right - i;
+        if (z[i] < 0) z[i] = 0;
+        while ((i + z[i] <= syncs) && (key[z[i]] == key[i + z[i]])) z[i]++;
+        if (i + z[i] > right)
+        {
+            left = i;
+            right = i + z[i];
+        }
+    }
+
+    /* first sync in the 2nd rotation where the blocks repeat up to
+       the last valid sync, or at least the first block repeats */
+    for (cycle = 0; cycle < syncs; cycle++)
+    {
+        if (sync[cycle] < 0x1780) continue;
+        if (z[cycle+1] >= ((cycle < valid) ? valid - cycle : 1)) break;
+    }
+    if (cycle == syncs) return (0);
+    cyclelen = sync[cycle];
+
+    /* find the longest block and sector 0 in the first rotation */
+    start = 0;
+    max_block_len = 0;
+    sector_zero_len = 0;
+    reason = START_GAP;
+    for (i = 0; i <= cycle; i++)
+    {
+        block_len = sync[i] - ((i == 0) ? 0 : sync[i-1]);
+        if (block_len > max_block_len)
+        {
+            max_block_len = block_len;
+            start = sync[i];
+        }
+        if ((sync[i] + 4 <= GCR_TRACK_LENGTH)
+            && is_sector_zero(mnib_track + sync[i]))
+        {
+            sector_zero_len = block_len;
+            pos = sync[i];
+        }
+    }
+    if ((sector_zero_len != 0) && ((sector_zero_len + 0x40) >= max_block_len))
+    {
+        start = pos;
+        reason = START_SECTOR0;
+    }
+
+    if (cyclelen >= 7900)
+    {
+        /* hack for psi5 killertrack */
+        if (extract_verbose) printf("- Cyclepos:  7900, start 0 (killer track)");
+        memcpy(gcr_track, mnib_track, (cyclelen < 7928) ? cyclelen : 7928);
+        return (7900);
+    }
+
+    /* start at beginning of the sync */
+    for (i = 0; i < cyclelen; i++)
+    {
+        pos = (start + cyclelen - 1) % cyclelen;
+        if (mnib_track[pos] != 0xff) break;
+        start = pos;
+    }
+    if (extract_verbose)
+        printf("- Cyclepos:  %d, start %d (%s)", cyclelen, start,
+               (reason == START_GAP) ? "longest gap" : "sector 0");
+
+    /* here comes the actual copy loop */
+    memcpy(gcr_track, mnib_track + start, cyclelen - start);
+    memcpy(gcr_track + cyclelen - start, mnib_track, start);
+
+    return (cyclelen);
+}
+
+
+
+DWORD extract_track_try2(BYTE *mnib_track, BYTE *gcr_track)
+{
+    int cyclelen;
+    int confidence;
+
+    cyclelen = find_track_cycle_len(mnib_track, &confidence);
+    if (cyclelen == 0)
+        return (0);
+
+    if (extract_verbose) printf("- Cyclepos:  %d (%d%%)", cyclelen, confidence);
+
+    /* killer track, see extract_track() */
+    if (cyclelen >= 7900) cyclelen = 7900;
+
+    /* here comes the actual copy loop */
+    memcpy(gcr_track, mnib_track, cyclelen);
+
+    return (cyclelen);
+}
+
+
+DWORD extract_track_bits(BYTE *mnib_track, BYTE *gcr_track)
+{
+    int cyclebits;
+    int confidence;
+    int len;
+
+    cyclebits = find_track_cycle_bits(mnib_track, &confidence);
+    if (cyclebits == 0)
+        return (0);
+
+    if (extract_verbose) printf("- Cyclebits: %d (%d%%)", cyclebits, confidence);
+
+    /* killer track, see extract_track() */
+    if (cyclebits >= 7900*8) cyclebits = 7900*8;
+
+    /* copy the cycle, fill up the last byte with sync bits */
+    len = cyclebits / 8;
+    memcpy(gcr_track, mnib_track, len);
+    if (cyclebits % 8)
+    {
+        gcr_track[len] = mnib_track[len] | (0xff >> (cyclebits % 8));
+        len++;
+    }
+
+    return (len);
+}
+
+
+/* extract one track cycle with the methods above, best one first
+   gcr_track must hold 7928 bytes.
+   Returns the cycle length, 0 if no cycle was found.
+*/
+DWORD extract_cycle(BYTE *mnib_track, BYTE *gcr_track)
+{
+    DWORD track_len;
+
+    track_len = extract_track(mnib_track, gcr_track);
+    if (track_len == 0)
+        track_len = extract_track_try2(mnib_track, gcr_track);
+    if (track_len == 0)
+        track_len = extract_track_bits(mnib_track, gcr_track);
+    return (track_len);
+}
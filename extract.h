@@ -0,0 +1,43 @@
+/* extract.h - extraction of track cycles from mnib nibbler data
+
+    (C) 2000,01 Markus Brenner <markus@brenner.de>
+
+    V 0.10   moved from n2g.c, used by n2g and nibstore
+    V 0.11   extract_track() has no static buffers
+*/
+
+#ifndef _EXTRACT_
+#define _EXTRACT_
+
+#include "gcr.h"
+
+
+/* version of extract.c, part of the key of cached n2g results */
+#define EXTRACT_VERSION 0.11
+
+
+/* max. number of syncs in a NIB track, each needs a $ff and another byte */
+#define MAX_SYNCS (GCR_TRACK_LENGTH / 2 + 1)
+
+/* reasons for the start of an extracted track */
+#define START_GAP       1   /* behind the longest gap */
+#define START_SECTOR0   2   /* at the header of sector 0 */
+
+
+extern int extract_verbose;
+
+
+int is_sector_zero(BYTE *data);
+
+BYTE *check_vmax(BYTE *mnib_track);
+
+DWORD extract_track(BYTE *mnib_track, BYTE *gcr_track);
+
+DWORD extract_track_try2(BYTE *mnib_track, BYTE *gcr_track);
+
+DWORD extract_track_bits(BYTE *mnib_track, BYTE *gcr_track);
+
+DWORD extract_cycle(BYTE *mnib_track, BYTE *gcr_track);
+
+
+#endif
@@ -7,6 +7,11 @@
     V 1.00   old monolithic version
     V 1.10   rewritten version using gcr.c helper functions
     V 1.20   adjusted to changed gcr functions
+    V 1.21   scan each track only once using a track index
+    V 1.22   added batch mode (-b)
+    V 1.23   tracks are converted independently, D64 is written at once
+    V 1.24   read image with image.c, tracks are not copied
+    V 1.25   tracks are converted by jobs, on all processors under Linux
 */
 
 
@@ -15,150 +20,205 @@
 #include <string.h>
 #include <fcntl.h>
 #include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "jobs.h"
 
-#define VERSION 1.20
+#define VERSION 1.25
 
 
 
+static int verbose = 1;     /* print sector status while converting */
+
+
+/* the tracks of one image, converted by convert_track_job() */
+struct g64_tracks
+{
+    struct disk_image *image;
+    BYTE *d64data;
+    BYTE *errorinfo;
+    BYTE *id;
+    int errors[35];         /* sectors with errors, -1: track not found */
+};
+
+
 void usage(void)
 {
-    fprintf(stderr, "Usage: g2d g64image [d64image]\n\n");
+    fprintf(stderr, "Usage: g2d g64image [d64image]\n"
+                    "       g2d -b g64image|directory|@manifest ...\n\n");
     exit (-1);
 }
 
 
-int main(int argc, char **argv)
+/* convert one track of the image, a job of run_jobs() */
+static void convert_track_job(void *context, int index)
 {
-    FILE *fp_g64, *fp_d64;
-    char g64name[1024], d64name[1024];
+    struct g64_tracks *tracks;
+    BYTE *gcr_start;
+    int cycle_len;
+
+    tracks = context;
+    lock_jobs();
+    gcr_start = image_track(tracks->image, (index + 1) * 2, &cycle_len);
+    unlock_jobs();
+
+    if (gcr_start == NULL)
+        tracks->errors[index] = -1;
+    else
+        tracks->errors[index] = convert_track_to_d64(gcr_start,
+                                                     gcr_start + cycle_len,
+                                                     tracks->d64data,
+                                                     tracks->errorinfo,
+                                                     index + 1, tracks->id);
+}
+
+
+/* convert one G64 image, returns 0 on success, -1 on failure
+   *errors is set to the number of sectors with errors */
+int convert_g64(char *g64name, char *d64name, int *errors)
+{
+    FILE *fp_d64;
+    struct disk_image image;
+    struct g64_tracks tracks;
     int track, sector;
     BYTE id[3];
-    BYTE gcr_track[7930], rawdata[260];
-    BYTE *gcr_start, *gcr_cycle; 
+    BYTE *gcr_start;
+    BYTE *d64data;
     BYTE errorinfo[MAXBLOCKSONDISK];
     BYTE errorcode;
-    int save_errorinfo;
-    unsigned long blockindex;
+    int blockindex;
     int cycle_len;
-    
-
-    fprintf(stdout,
-"\ng2d is a small stand-alone converter to convert a G64 disk image to\n"
-"a standard D64 disk image.  Copyright 1999-2001 Markus Brenner.\n"
-"This is free software, covered by the GNU General Public License.\n"
-"Version %.2f\n\n", VERSION);
+    int status;
 
+    *errors = 0;
+    status = -1;
     id[0]=id[1]=id[2] = '\0';
 
-    if (argc == 2)
-    {
-        char *dot;
-        strcpy(g64name, argv[1]);
-        strcpy(d64name, g64name);
-        dot = strrchr(d64name, '.');
-        if (dot != NULL)
-            strcpy(dot, ".d64");
-        else
-            strcat(d64name, ".d64");
-    }
-    else if (argc == 3)
+    d64data = malloc(BLOCKSONDISK*256);
+    if (d64data == NULL)
     {
-        strcpy(g64name, argv[1]);
-        strcpy(d64name, argv[2]);
+        fprintf(stderr, "Cannot allocate D64 buffer.\n");
+        return (-1);
     }
-    else usage();
-
 
-    fp_g64 = fopen(g64name, "rb");
-    if (fp_g64 == NULL)
+    if (!open_image(&image, g64name))
     {
-        fprintf(stderr, "Cannot open G64 image %s.\n", g64name);
-        exit (-1);
+        free(d64data);
+        return (-1);
     }
 
     fp_d64 = fopen(d64name, "wb");
     if (fp_d64 == NULL) {
         fprintf(stderr, "Cannot open D64 image %s.\n", d64name);
-        exit (-1);
+        close_image(&image);
+        free(d64data);
+        return (-1);
     }
 
-    /* skip header and track offset information */
-    fseek(fp_g64, 12 + MAX_TRACKS_1541 * 16, SEEK_SET);
-
     /* first, try to figure out ID from track 18 */
-    fseek(fp_g64, 17 * 7930, SEEK_CUR);
-    if (fread(gcr_track, 7930, 1, fp_g64) < 1)
+    gcr_start = image_track(&image, 18*2, &cycle_len);
+    if (gcr_start == NULL)
     {
         fprintf(stderr, "Cannot read track from G64 image.\n");
         goto fail;
     }
-    if (!extract_id(gcr_track, id))
+    if (!extract_id(gcr_start, id))
     {
         fprintf(stderr, "Cannot find directory sector.\n");
         goto fail;
     }
 
-    /* skip header and track offset information */
-    fseek(fp_g64, 12 + MAX_TRACKS_1541 * 16, SEEK_SET);
+    /* each track fills its own blocks of d64data and errorinfo */
+    tracks.image = &image;
+    tracks.d64data = d64data;
+    tracks.errorinfo = errorinfo;
+    tracks.id = id;
+    run_jobs(35, convert_track_job, &tracks);
 
-    blockindex = 0;
-    save_errorinfo = 0;
     for (track = 0; track < 35; track++)
     {
-
-    	/* read in one track */
-        if (fread(gcr_track, 7930, 1, fp_g64) < 1)
+        if (tracks.errors[track] < 0)
         {
             fprintf(stderr, "Cannot read track from G64 image.\n");
             goto fail;
         }
+        *errors += tracks.errors[track];
 
-        cycle_len = (gcr_track[1] << 8) | gcr_track[0];
+        if (!verbose) continue;
         printf("\nTrack: %2d - Sector: ",track+1);
-
-        gcr_start = gcr_track+2;
-        gcr_cycle = gcr_track+2+cycle_len;
-
+        blockindex = d64_block_offset(track + 1);
         for (sector = 0; sector < sector_map_1541[track + 1]; sector++)
         {
-            BYTE chksum;
-            int i;
-
             printf("%d",sector);
-
-            errorcode = convert_GCR_sector(gcr_start, gcr_cycle,
-                                           rawdata,
-                                           track + 1, sector, id);
-
-            errorinfo[blockindex] = errorcode;	/* OK by default */
-            if (errorcode != OK) save_errorinfo = 1;
-
+            errorcode = errorinfo[blockindex++];
             if (errorcode == OK)
                 printf(" ");
             else
                 printf("%d",errorcode);
-
-            if (fwrite((char *) rawdata+1, 256, 1, fp_d64) != 1)
-            {
-                fprintf(stderr, "Cannot write sector data.\n");
-                goto fail;
-            }
-
-            blockindex++;
         }
     }
 
     /* Missing: Track 36-40 detection */
 
-    if (save_errorinfo)
+    if (fwrite((char *) d64data, BLOCKSONDISK*256, 1, fp_d64) != 1)
+    {
+        fprintf(stderr, "Cannot write sector data.\n");
+        goto fail;
+    }
+
+    if (*errors != 0)
     {
         if (fwrite((char *) errorinfo, BLOCKSONDISK, 1, fp_d64) != 1) {
             fprintf(stderr, "Cannot write error information.\n");
             goto fail;
         }
     }
+    status = 0;
 
 fail:
+    close_image(&image);
     fclose(fp_d64);
-    return -1;
+    free(d64data);
+    return (status);
+}
+
+
+int main(int argc, char **argv)
+{
+    char g64name[1024], d64name[1024];
+    int errors;
+
+    fprintf(stdout,
+"\ng2d is a small stand-alone converter to convert a G64 disk image to\n"
+"a standard D64 disk image.  Copyright 1999-2001 Markus Brenner.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    init_GCR_kernels();
+
+    if ((argc >= 3) && (strcmp(argv[1], "-b") == 0))
+    {
+        verbose = 0;
+        return (run_batch(argc-2, argv+2, ".g64", ".d64", convert_g64));
+    }
+
+    if (argc == 2)
+    {
+        char *dot;
+        strcpy(g64name, argv[1]);
+        strcpy(d64name, g64name);
+        dot = strrchr(d64name, '.');
+        if (dot != NULL)
+            strcpy(dot, ".d64");
+        else
+            strcat(d64name, ".d64");
+    }
+    else if (argc == 3)
+    {
+        strcpy(g64name, argv[1]);
+        strcpy(d64name, argv[2]);
+    }
+    else usage();
+
+    return (convert_g64(g64name, d64name, &errors));
 }
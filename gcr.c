@@ -8,12 +8,39 @@
     V 0.32   removed some functions, added sector-2-GCR conversion
     V 0.33   improved sector extraction, added find_track_cycle() function
     V 0.34   added MAX_SYNC_OFFSET constant, for better error conversion
+    V 0.35   added bulk GCR decoding with invalid quintet mask
+    V 0.36   added bulk GCR encoding and whole track synthesis
+    V 0.37   added track index, sectors are converted from one track scan
+    V 0.38   added circular track cycle view, no more doubled track buffer
+    V 0.39   find_track_cycle() uses linear time rolling hash search
+    V 0.40   added bit-aligned sync and cycle search on 64-bit words
+    V 0.41   block headers are matched in GCR space
+    V 0.42   added quintet pair decoder (gcr_tab.h), fastest one is used
+    V 0.43   added convert_track_to_d64(), tracks are independent
+    V 0.44   added find_cycle_rotation(), aligns two track cycles
+    V 0.45   no state set up on first use, tracks can be converted by
+             several threads at once, see init_GCR_decoder()
+    V 0.46   added SSE2 and AVX2 decoder kernels for x86 GCC builds
+    V 0.47   added AVX2 encoder kernel, init_GCR_decoder() is now
+             init_GCR_kernels() and picks the encoder as well
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "gcr.h"
+#include "gcr_tab.h"       /* generated by mkgcrtab */
+
+/* SSE2 and AVX2 encoder and decoder kernels, compiled for their
+   instruction set only and used if the CPU and the OS support it.
+   Define GCR_NO_SIMD to leave them out. */
+#if defined(__GNUC__) && (__GNUC__ >= 5) && !defined(GCR_NO_SIMD) \
+    && (defined(__i386__) || defined(__x86_64__))
+#define GCR_SIMD_KERNELS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 
 char sector_map_1541[43] =
@@ -27,6 +54,13 @@ char sector_map_1541[43] =
 };
 
 
+/* number of GCR bytes on a track in speed zone 0-3 */
+int raw_track_size[4] =
+{
+    6250, 6666, 7142, 7692
+};
+
+
 int speed_map_1541[42] =
 {
     3, 3, 3, 3, 3, 3, 3, 3, 3, 3,               /*  1 - 10 */
@@ -64,6 +98,23 @@ static BYTE GCR_decode_low[32] =
     0xff, 0x09, 0x0a, 0x0b, 0xff, 0x0d, 0x0e, 0xff 
 };
 
+/* same as above for bulk decoding, invalid codes additionally set bit 8 */
+static unsigned short GCR_bulk_high[32] =
+{
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x080, 0x000, 0x010, 0x1ff, 0x0c0, 0x040, 0x050,
+    0x1ff, 0x1ff, 0x020, 0x030, 0x1ff, 0x0f0, 0x060, 0x070,
+    0x1ff, 0x090, 0x0a0, 0x0b0, 0x1ff, 0x0d0, 0x0e0, 0x1ff
+};
+
+static unsigned short GCR_bulk_low[32] =
+{
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x008, 0x000, 0x001, 0x1ff, 0x00c, 0x004, 0x005,
+    0x1ff, 0x1ff, 0x002, 0x003, 0x1ff, 0x00f, 0x006, 0x007,
+    0x1ff, 0x009, 0x00a, 0x00b, 0x1ff, 0x00d, 0x00e, 0x1ff
+};
+
 
 int find_sync(BYTE **gcr_pptr, BYTE *gcr_end)
 {
@@ -101,6 +152,106 @@ void convert_4bytes_to_GCR(BYTE *buffer, BYTE *ptr)
 }
 
 
+/* GCR group encoder kernels, encode a run of 4 byte groups into 5 GCR
+   bytes each */
+
+/* Each plain byte is looked up as a complete 10 bit GCR pair in
+   GCR_encode_pair (gcr_tab.h), two pairs are combined into a 20 bit
+   word and the 40 bits of a group are then written out with shifts
+   only. */
+static void encode_groups_pair(BYTE *buffer, BYTE *ptr, int groups)
+{
+    DWORD hi, lo;
+
+    for (; groups > 0; groups--)
+    {
+        hi = ((DWORD) GCR_encode_pair[buffer[0]] << 10)
+           | GCR_encode_pair[buffer[1]];
+        lo = ((DWORD) GCR_encode_pair[buffer[2]] << 10)
+           | GCR_encode_pair[buffer[3]];
+        buffer += 4;
+
+        ptr[0] = hi >> 12;
+        ptr[1] = hi >> 4;
+        ptr[2] = (hi << 4) | (lo >> 16);
+        ptr[3] = lo >> 8;
+        ptr[4] = lo;
+        ptr += 5;
+    }
+}
+
+
+#if defined(GCR_SIMD_KERNELS)
+
+/* four groups per step, packed in vector registers
+
+   The nibbles of 16 plain bytes are encoded by two 16 byte shuffles of
+   GCR_conv_data.  A multiply-add joins each pair of quintets to 10
+   bits, a second one joins two pairs to the 20 bit halves of a group.
+   The halves are shifted together in the 64 bit word of their group
+   and the 5 GCR bytes are shuffled out in big endian order.  A step
+   writes 26 bytes, the last groups are left to the scalar kernel. */
+__attribute__((target("avx2")))
+static void encode_groups_avx2(BYTE *buffer, BYTE *ptr, int groups)
+{
+    __m128i conv, nibble, data, high, low;
+    __m256i order, pairs, halves, gcr;
+
+    conv = _mm_loadu_si128((__m128i *) GCR_conv_data);
+    nibble = _mm_set1_epi8(0x0f);
+    order = _mm256_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+                             -1, -1, -1, -1, -1, -1,
+                             4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+                             -1, -1, -1, -1, -1, -1);
+
+    for (; groups >= 6; groups -= 4)
+    {
+        data = _mm_loadu_si128((__m128i *) buffer);
+        buffer += 16;
+
+        high = _mm_shuffle_epi8(conv,
+                   _mm_and_si128(_mm_srli_epi16(data, 4), nibble));
+        low = _mm_shuffle_epi8(conv, _mm_and_si128(data, nibble));
+
+        /* groups 0, 1 and 2, 3, one per lane */
+        pairs = _mm256_inserti128_si256(
+                    _mm256_castsi128_si256(_mm_unpacklo_epi8(high, low)),
+                    _mm_unpackhi_epi8(high, low), 1);
+        pairs = _mm256_maddubs_epi16(pairs, _mm256_set1_epi16(0x0120));
+        halves = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010400));
+
+        /* bits 40-63 of each group are not stored */
+        gcr = _mm256_or_si256(_mm256_slli_epi64(halves, 20),
+                              _mm256_srli_epi64(halves, 32));
+        gcr = _mm256_shuffle_epi8(gcr, order);
+
+        _mm_storeu_si128((__m128i *) ptr, _mm256_castsi256_si128(gcr));
+        _mm_storeu_si128((__m128i *) (ptr + 10),
+                         _mm256_extracti128_si256(gcr, 1));
+        ptr += 20;
+    }
+    encode_groups_pair(buffer, ptr, groups);
+}
+
+#endif
+
+
+/* kernel used until init_GCR_kernels() */
+static void (*encode_groups)(BYTE *buffer, BYTE *ptr, int groups)
+    = encode_groups_pair;
+
+
+/* encode a run of 4 byte groups into 5 GCR bytes each
+
+   Same result as convert_4bytes_to_GCR() for each group.  The encoder
+   kernel is chosen by init_GCR_kernels().
+*/
+void convert_bytes_to_GCR(BYTE *buffer, BYTE *ptr, int groups)
+{
+    encode_groups(buffer, ptr, groups);
+}
+
+
 void convert_4bytes_from_GCR(BYTE *gcr, BYTE *plain)
 {
     BYTE hnibble, lnibble;
@@ -123,6 +274,356 @@ void convert_4bytes_from_GCR(BYTE *gcr, BYTE *plain)
 }
 
 
+/* find invalid quintets in a run of GCR groups, see below */
+static int check_GCR_groups(BYTE *gcr, int groups, BYTE *errmask)
+{
+    BYTE q[8];
+    BYTE bad;
+    int badgroups;
+    int i;
+
+    for (badgroups = 0; groups > 0; groups--)
+    {
+        q[0] = gcr[0] >> 3;
+        q[1] = ((gcr[0] << 2) | (gcr[1] >> 6)) & 0x1f;
+        q[2] = (gcr[1] >> 1) & 0x1f;
+        q[3] = ((gcr[1] << 4) | (gcr[2] >> 4)) & 0x1f;
+        q[4] = ((gcr[2] << 1) | (gcr[3] >> 7)) & 0x1f;
+        q[5] = (gcr[3] >> 2) & 0x1f;
+        q[6] = ((gcr[3] << 3) | (gcr[4] >> 5)) & 0x1f;
+        q[7] = gcr[4] & 0x1f;
+        gcr += 5;
+
+        for (bad = 0, i = 0; i < 8; i++)
+            if (GCR_bulk_low[q[i]] & 0x100) bad |= 0x80 >> i;
+
+        if (bad) badgroups++;
+        if (errmask != NULL) *errmask++ = bad;
+    }
+    return (badgroups);
+}
+
+
+/* GCR group decoder kernels, decode a run of 5-byte groups into 4 plain
+   bytes each and return the OR of all decoded values (bit 8 = invalid) */
+
+/* two 32 entry lookups per byte */
+static unsigned int decode_groups_quintet(BYTE *gcr, BYTE *plain, int groups)
+{
+    unsigned int b0, b1, b2, b3;
+    unsigned int check;
+
+    for (check = 0; groups > 0; groups--)
+    {
+        b0 = GCR_bulk_high[gcr[0] >> 3]
+           | GCR_bulk_low[((gcr[0] << 2) | (gcr[1] >> 6)) & 0x1f];
+        b1 = GCR_bulk_high[(gcr[1] >> 1) & 0x1f]
+           | GCR_bulk_low[((gcr[1] << 4) | (gcr[2] >> 4)) & 0x1f];
+        b2 = GCR_bulk_high[((gcr[2] << 1) | (gcr[3] >> 7)) & 0x1f]
+           | GCR_bulk_low[(gcr[3] >> 2) & 0x1f];
+        b3 = GCR_bulk_high[((gcr[3] << 3) | (gcr[4] >> 5)) & 0x1f]
+           | GCR_bulk_low[gcr[4] & 0x1f];
+        gcr += 5;
+
+        plain[0] = b0;
+        plain[1] = b1;
+        plain[2] = b2;
+        plain[3] = b3;
+        plain += 4;
+
+        check |= b0 | b1 | b2 | b3;
+    }
+    return (check);
+}
+
+
+/* one 1024 entry lookup per byte, the 40 bit group is read as one word */
+static unsigned int decode_groups_pair(BYTE *gcr, BYTE *plain, int groups)
+{
+    QWORD group;
+    unsigned int b0, b1, b2, b3;
+    unsigned int check;
+
+    for (check = 0; groups > 0; groups--)
+    {
+        group = ((QWORD) gcr[0] << 32)
+              | (DWORD) ((gcr[1] << 24) | (gcr[2] << 16)
+                         | (gcr[3] << 8) | gcr[4]);
+        gcr += 5;
+
+        b0 = GCR_decode_pair[(unsigned int) (group >> 30) & 0x3ff];
+        b1 = GCR_decode_pair[(unsigned int) (group >> 20) & 0x3ff];
+        b2 = GCR_decode_pair[(unsigned int) (group >> 10) & 0x3ff];
+        b3 = GCR_decode_pair[(unsigned int) group & 0x3ff];
+
+        plain[0] = b0;
+        plain[1] = b1;
+        plain[2] = b2;
+        plain[3] = b3;
+        plain += 4;
+
+        check |= b0 | b1 | b2 | b3;
+    }
+    return (check);
+}
+
+
+#if defined(GCR_SIMD_KERNELS)
+
+/* two groups per step in the 64 bit halves of a register
+
+   The quintet pairs of a group are the 16 bit words of bytes 0-1, 1-2,
+   2-3 and 3-4, shifted right by 6, 4, 2 and 0 bits.  The words are
+   swapped to big endian, shifted into place by a multiplication and
+   looked up in GCR_decode_pair like in decode_groups_pair().  A step
+   reads 13 bytes, the last groups are left to the scalar kernel. */
+__attribute__((target("sse2")))
+static unsigned int decode_groups_sse2(BYTE *gcr, BYTE *plain, int groups)
+{
+    __m128i data, even, odd;
+    unsigned int b0, b1, b2, b3, b4, b5, b6, b7;
+    unsigned int check;
+
+    for (check = 0; groups >= 3; groups -= 2)
+    {
+        data = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i *) gcr),
+                                  _mm_loadl_epi64((__m128i *) (gcr + 5)));
+        gcr += 10;
+
+        /* words of bytes 0-1, 2-3 and of bytes 1-2, 3-4 */
+        even = _mm_or_si128(_mm_slli_epi16(data, 8), _mm_srli_epi16(data, 8));
+        data = _mm_srli_si128(data, 1);
+        odd = _mm_or_si128(_mm_slli_epi16(data, 8), _mm_srli_epi16(data, 8));
+
+        even = _mm_srli_epi16(_mm_mullo_epi16(even,
+                              _mm_set_epi16(0, 0, 16, 1, 0, 0, 16, 1)), 6);
+        odd = _mm_srli_epi16(_mm_mullo_epi16(odd,
+                             _mm_set_epi16(0, 0, 64, 4, 0, 0, 64, 4)), 6);
+
+        b0 = GCR_decode_pair[_mm_extract_epi16(even, 0)];
+        b1 = GCR_decode_pair[_mm_extract_epi16(odd, 0)];
+        b2 = GCR_decode_pair[_mm_extract_epi16(even, 1)];
+        b3 = GCR_decode_pair[_mm_extract_epi16(odd, 1)];
+        b4 = GCR_decode_pair[_mm_extract_epi16(even, 4)];
+        b5 = GCR_decode_pair[_mm_extract_epi16(odd, 4)];
+        b6 = GCR_decode_pair[_mm_extract_epi16(even, 5)];
+        b7 = GCR_decode_pair[_mm_extract_epi16(odd, 5)];
+
+        plain[0] = b0;
+        plain[1] = b1;
+        plain[2] = b2;
+        plain[3] = b3;
+        plain[4] = b4;
+        plain[5] = b5;
+        plain[6] = b6;
+        plain[7] = b7;
+        plain += 8;
+
+        check |= b0 | b1 | b2 | b3 | b4 | b5 | b6 | b7;
+    }
+    return (check | decode_groups_pair(gcr, plain, groups));
+}
+
+
+/* four groups per step without table lookups
+
+   Each 128 bit lane takes one group and its 8 quintets as 16 bit words
+   of the two bytes around each quintet, shifted into place by a
+   multiplication.  The quintets are packed to bytes and decoded by two
+   16 byte shuffles of GCR_decode_low, invalid quintets give 0xff.  A
+   multiply-add puts each pair of nibbles together, saturating to 0xff
+   if one of them is invalid.  A step reads 26 bytes, the last groups
+   are left to the scalar kernel. */
+__attribute__((target("avx2")))
+static unsigned int decode_groups_avx2(BYTE *gcr, BYTE *plain, int groups)
+{
+    __m256i window, shift, low, high, first, second;
+    __m256i quintets, nibbles, bytes;
+    __m256i invalid;
+
+    /* bytes around quintet 0-7 of the group at byte 0 and at byte 5 */
+    window = _mm256_setr_epi8(1, 0, 1, 0, 2, 1, 2, 1,
+                              3, 2, 4, 3, 4, 3, -1, 4,
+                              6, 5, 6, 5, 7, 6, 7, 6,
+                              8, 7, 9, 8, 9, 8, -1, 9);
+    shift = _mm256_setr_epi16(1, 32, 4, 128, 16, 2, 64, 8,
+                              1, 32, 4, 128, 16, 2, 64, 8);
+    low = _mm256_broadcastsi128_si256(
+              _mm_loadu_si128((__m128i *) GCR_decode_low));
+    high = _mm256_broadcastsi128_si256(
+               _mm_loadu_si128((__m128i *) (GCR_decode_low + 16)));
+    invalid = _mm256_setzero_si256();
+
+    for (; groups >= 6; groups -= 4)
+    {
+        /* groups 0, 1 and 2, 3, one per lane */
+        first = _mm256_broadcastsi128_si256(
+                    _mm_loadu_si128((__m128i *) gcr));
+        second = _mm256_broadcastsi128_si256(
+                     _mm_loadu_si128((__m128i *) (gcr + 10)));
+        gcr += 20;
+
+        first = _mm256_srli_epi16(_mm256_mullo_epi16(
+                    _mm256_shuffle_epi8(first, window), shift), 11);
+        second = _mm256_srli_epi16(_mm256_mullo_epi16(
+                     _mm256_shuffle_epi8(second, window), shift), 11);
+        quintets = _mm256_packus_epi16(first, second);
+
+        nibbles = _mm256_blendv_epi8(
+                      _mm256_shuffle_epi8(low, quintets),
+                      _mm256_shuffle_epi8(high, quintets),
+                      _mm256_slli_epi16(quintets, 3));
+        invalid = _mm256_or_si256(invalid,
+                      _mm256_cmpeq_epi8(nibbles, _mm256_set1_epi8(-1)));
+
+        bytes = _mm256_maddubs_epi16(nibbles, _mm256_set1_epi16(0x0110));
+        bytes = _mm256_packus_epi16(bytes, bytes);
+
+        /* lanes hold groups 0, 2 and 1, 3 */
+        bytes = _mm256_permutevar8x32_epi32(bytes,
+                    _mm256_setr_epi32(0, 4, 1, 5, 0, 4, 1, 5));
+        _mm_storeu_si128((__m128i *) plain, _mm256_castsi256_si128(bytes));
+        plain += 16;
+    }
+
+    return ((_mm256_movemask_epi8(invalid) ? 0x100 : 0)
+            | decode_groups_pair(gcr, plain, groups));
+}
+
+
+/* CPU and OS support of the kernels above */
+static int has_sse2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return (0);
+    return ((edx & bit_SSE2) != 0);
+}
+
+
+static int has_avx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return (0);
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return (0);
+
+    /* the OS saves the YMM registers */
+    __asm__ (".byte 0x0f, 0x01, 0xd0"       /* xgetbv */
+             : "=a" (eax), "=d" (edx) : "c" (0));
+    if ((eax & 6) != 6) return (0);
+
+    if (__get_cpuid_max(0, NULL) < 7) return (0);
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ((ebx & bit_AVX2) != 0);
+}
+
+#endif
+
+
+/* sector encodes and decodes timed per kernel by init_GCR_kernels() */
+#define KERNEL_RUNS 64
+
+/* kernel used until init_GCR_kernels() and kept if the clock cannot
+   tell them apart, define GCR_QUINTET_DECODER to prefer the 32-entry
+   lookups */
+#if defined(GCR_QUINTET_DECODER)
+#define DEFAULT_DECODER decode_groups_quintet
+#else
+#define DEFAULT_DECODER decode_groups_pair
+#endif
+
+static unsigned int (*decode_groups)(BYTE *gcr, BYTE *plain, int groups)
+    = DEFAULT_DECODER;
+
+
+/* pick the fastest encoder and decoder kernels on this machine by
+   converting a sector KERNEL_RUNS times with each of them.  The SSE2
+   and AVX2 kernels take part if the CPU has them, the scalar ones are
+   always there.  This takes well under a millisecond, a coarse clock
+   (18.2 Hz on DOS) mostly sees no difference and the default kernels
+   stay.
+   Programs call it once at startup, before any thread converts tracks. */
+void init_GCR_kernels(void)
+{
+    void (*encoder[2])(BYTE *buffer, BYTE *ptr, int groups);
+    unsigned int (*decoder[4])(BYTE *gcr, BYTE *plain, int groups);
+    BYTE buffer[260];
+    BYTE gcr[325];
+    clock_t start, elapsed, fastest;
+    int encoders, decoders;
+    int i, runs;
+
+    encoders = 0;
+    encoder[encoders++] = encode_groups_pair;
+#if defined(GCR_SIMD_KERNELS)
+    if (has_avx2()) encoder[encoders++] = encode_groups_avx2;
+#endif
+
+    decoders = 0;
+    decoder[decoders++] = DEFAULT_DECODER;
+    decoder[decoders++] = (DEFAULT_DECODER == decode_groups_pair)
+                          ? decode_groups_quintet : decode_groups_pair;
+#if defined(GCR_SIMD_KERNELS)
+    if (has_sse2()) decoder[decoders++] = decode_groups_sse2;
+    if (has_avx2()) decoder[decoders++] = decode_groups_avx2;
+#endif
+
+    for (i = 0; i < 260; i++) buffer[i] = i;
+
+    /* the first kernel is the default, the others must be faster */
+    fastest = 0;
+    for (i = 0; i < encoders; i++)
+    {
+        start = clock();
+        for (runs = 0; runs < KERNEL_RUNS; runs++)
+            encoder[i](buffer, gcr, 65);
+        elapsed = clock() - start;
+
+        if ((i == 0) || (elapsed < fastest))
+        {
+            encode_groups = encoder[i];
+            fastest = elapsed;
+        }
+    }
+
+    fastest = 0;
+    for (i = 0; i < decoders; i++)
+    {
+        start = clock();
+        for (runs = 0; runs < KERNEL_RUNS; runs++)
+            decoder[i](gcr, buffer, 65);
+        elapsed = clock() - start;
+
+        if ((i == 0) || (elapsed < fastest))
+        {
+            decode_groups = decoder[i];
+            fastest = elapsed;
+        }
+    }
+}
+
+
+/* decode a run of 5-byte GCR groups into 4 plain bytes each
+
+   Invalid quintets still decode to 0xff nibbles like in
+   convert_4bytes_from_GCR(), but are flagged in errmask[group]
+   (bit 7 = first quintet ... bit 0 = last quintet) if errmask is not NULL.
+   The decode loop only collects a single error flag, the slow check is
+   done afterwards if anything was wrong.
+   The decoder kernel is chosen by init_GCR_kernels().
+   Returns the number of groups with invalid quintets.
+*/
+int convert_bytes_from_GCR(BYTE *gcr, BYTE *plain, int groups, BYTE *errmask)
+{
+    if (decode_groups(gcr, plain, groups) & 0x100)
+        return (check_GCR_groups(gcr, groups, errmask));
+
+    if (errmask != NULL) memset(errmask, 0, groups);
+    return (0);
+}
+
+
 int extract_id(BYTE *gcr_track, BYTE *id)
 {
     BYTE header[10];
@@ -150,23 +651,203 @@ int extract_id(BYTE *gcr_track, BYTE *id)
 
 
 
-int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_cycle,
-                       BYTE *d64_sector,
-                       int track, int sector, BYTE *id)
+/* set up a circular view of the track cycle between gcr_start and gcr_cycle
+
+   Positions in the view run on over the end of the cycle into the next
+   revolution, so blocks across the end of the cycle are read without
+   having to copy the track twice.
+*/
+void set_track_cycle(struct track_cycle *cycle,
+                     BYTE *gcr_start, BYTE *gcr_cycle)
+{
+    cycle->gcr_start = gcr_start;
+    cycle->track_len = gcr_cycle-gcr_start;
+}
+
+
+/* find_sync() for a track cycle, positions up to end (max. 2 cycles) */
+int find_cycle_sync(struct track_cycle *cycle, int *pos, int end)
+{
+    BYTE *gcr_ptr, *gcr_end;
+    int p;
+
+    p = *pos;
+    if (p >= end) return (0);
+
+    gcr_ptr = cycle->gcr_start + (p % cycle->track_len);
+    gcr_end = cycle->gcr_start + cycle->track_len;
+
+    while ((p < end) && (*gcr_ptr != 0xff))
+    {
+        p++;
+        if (++gcr_ptr == gcr_end) gcr_ptr = cycle->gcr_start;
+    }
+    while ((p < end) && (*gcr_ptr == 0xff))
+    {
+        p++;
+        if (++gcr_ptr == gcr_end) gcr_ptr = cycle->gcr_start;
+    }
+
+    *pos = p;
+    return (p < end);
+}
+
+
+/* copy GCR data from a track cycle, wrapping around at the cycle end */
+void copy_cycle_bytes(struct track_cycle *cycle, int pos,
+                      BYTE *dest, int len)
+{
+    int chunk;
+
+    pos %= cycle->track_len;
+    while (len > 0)
+    {
+        chunk = cycle->track_len - pos;
+        if (chunk > len) chunk = len;
+        memcpy(dest, cycle->gcr_start + pos, chunk);
+        dest += chunk;
+        len -= chunk;
+        pos = 0;
+    }
+}
+
+
+/* convert_bytes_from_GCR() for a track cycle
+
+   Groups are decoded in place, only data running over the cycle end
+   is copied to a small buffer first.
+*/
+int convert_cycle_from_GCR(struct track_cycle *cycle, int pos,
+                           BYTE *plain, int groups, BYTE *errmask)
+{
+    BYTE gcr_buffer[65*5];
+    int chunk;
+    int badgroups;
+
+    pos %= cycle->track_len;
+    if (pos + groups*5 <= cycle->track_len)
+        return (convert_bytes_from_GCR(cycle->gcr_start + pos, plain,
+                                       groups, errmask));
+
+    for (badgroups = 0; groups > 0; groups -= chunk)
+    {
+        chunk = (groups > 65) ? 65 : groups;
+        copy_cycle_bytes(cycle, pos, gcr_buffer, chunk*5);
+        badgroups += convert_bytes_from_GCR(gcr_buffer, plain, chunk,
+                                            errmask);
+        pos = (pos + chunk*5) % cycle->track_len;
+        plain += chunk*4;
+        if (errmask != NULL) errmask += chunk;
+    }
+    return (badgroups);
+}
+
+
+/* build index of all block headers in a track cycle
+
+   The cycle is walked once over two revolutions, so blocks crossing the
+   end of the cycle are seen as well.  Sync gaps are checked on the way
+   and every header block found is stored with its decoded header, the
+   position of the following data block and the sync in front of it.
+   Positions are counted from gcr_start and may exceed the cycle length.
+   Returns the track status: OK, SYNC_NOT_FOUND or 0 if there is no cycle.
+*/
+int index_GCR_track(BYTE *gcr_start, BYTE *gcr_cycle,
+                    struct track_index *index)
+{
+    struct track_cycle *cycle;
+    struct sector_header *entry;
+    BYTE *gcr_ptr;
+    int pos, last, end;
+    int track_len;
+    int ff_bytes;
+    int sync_len;
+
+    cycle = &index->cycle;
+    set_track_cycle(cycle, gcr_start, gcr_start);
+    index->status = 0;
+    index->syncs = 0;
+    index->max_gap = 0;
+    index->headers = 0;
+    if ((gcr_cycle == NULL) || (gcr_cycle < gcr_start)) return (0);
+
+    set_track_cycle(cycle, gcr_start, gcr_cycle);
+    track_len = cycle->track_len;
+    if (track_len == 0) return (index->status = SYNC_NOT_FOUND);
+
+    /* a Sync needs some $ff bytes at all (3 within two revolutions) */
+    for (ff_bytes = 0, gcr_ptr = gcr_start; gcr_ptr < gcr_cycle; gcr_ptr++)
+        if ((*gcr_ptr == 0xff) && (++ff_bytes == 2)) break;
+    index->status = (ff_bytes == 2) ? OK : SYNC_NOT_FOUND;
+
+    /* walk all syncs, check for missing SYNCs and note block headers */
+    entry = NULL;
+    end = 2*track_len;
+    last = pos = 0;
+    while (pos < end)
+    {
+        if (!find_cycle_sync(cycle, &pos, end)) pos = end;
+
+        if (pos-last > index->max_gap) index->max_gap = pos-last;
+        last = pos;
+        if (pos >= end) break;
+
+        /* this sync starts the data block of the last header */
+        if (entry != NULL)
+        {
+            entry->data = pos;
+            entry = NULL;
+        }
+
+        /* second revolution only repeats the headers of the first */
+        if (pos > track_len) continue;
+        index->syncs++;
+
+        if (pos >= end - 10) continue;
+        if (index->headers == MAX_TRACK_HEADERS) continue;
+
+        /* header block mark $08 is GCR 01010 01001 */
+        entry = &index->header[index->headers];
+        copy_cycle_bytes(cycle, pos, entry->gcr, 10);
+        if ((entry->gcr[0] != 0x52) || ((entry->gcr[1] & 0xc0) != 0x40))
+        {
+            entry = NULL;
+            continue;
+        }
+
+        entry->pos = pos;
+        entry->data = -1;
+        gcr_ptr = gcr_start + (pos % track_len);
+        for (sync_len = 0; sync_len < track_len; sync_len++)
+        {
+            if (gcr_ptr == gcr_start) gcr_ptr = gcr_cycle;
+            if (*--gcr_ptr != 0xff) break;
+        }
+        entry->sync_len = sync_len;
+        index->headers++;
+    }
+    if (index->max_gap > MAX_SYNC_OFFSET) index->status = SYNC_NOT_FOUND;
+
+    return (index->status);
+}
+
+
+/* convert a sector using the block headers found by index_GCR_track() */
+int convert_indexed_sector(struct track_index *index,
+                           BYTE *d64_sector,
+                           int track, int sector, BYTE *id)
 {
-    BYTE header[10];    /* block header */
+    BYTE header[8];     /* block header */
     BYTE hdr_chksum;    /* header checksum */
     BYTE blk_chksum;    /* block  checksum */
-    BYTE gcr_buffer[2*GCR_TRACK_LENGTH];
-    BYTE *gcr_ptr, *gcr_end, *gcr_last;
-    BYTE *sectordata;
+    BYTE gcr[5];        /* GCR of header mark, sector and track */
+    struct sector_header *entry;
     int error_code;
-    int sync_found;
-    int track_len;
+    int groups;
     int i;
 
     if (track > MAX_TRACK_D64) return (0);
-    if ((gcr_cycle == NULL) || (gcr_cycle < gcr_start)) return (0);
+    if (index->status == 0) return (0);
 
     /* initialize sector data with Original Format Pattern */
     memset(d64_sector, 0x01, 260);
@@ -176,51 +857,23 @@ int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_cycle,
         blk_chksum ^= d64_sector[i + 1];
     d64_sector[257] = blk_chksum;
 
-    /* copy to  temp. buffer with twice the track data */
-    track_len = gcr_cycle - gcr_start;
-    memcpy(gcr_buffer, gcr_start, track_len);
-    memcpy(gcr_buffer+track_len, gcr_start, track_len);
-    track_len *= 2;
-
-    /* Check for at least one Sync */
-    gcr_end = gcr_buffer+track_len;
-    sync_found = 0;
-    for (gcr_ptr = gcr_buffer; gcr_ptr < gcr_end; gcr_ptr++)
-    {
-        if (*gcr_ptr == 0xff)
-            if (sync_found < 2) sync_found++;
-        else /* (*gcr_ptr != 0xff) */
-        {
-            if (sync_found < 2) sync_found = 0;
-            else sync_found = 3;
-        }
-    }
-    if (sync_found != 3) return(SYNC_NOT_FOUND);
-
-
-    /* Check for missing SYNCs */
-    gcr_last = gcr_ptr = gcr_buffer;
-    while (gcr_ptr < gcr_end)
-    {
-        find_sync(&gcr_ptr, gcr_end);
-        if ((gcr_ptr-gcr_last) > MAX_SYNC_OFFSET)
-            return (SYNC_NOT_FOUND);
-        else
-            gcr_last = gcr_ptr;
-    }
-
-
-    /* Try to find block header for Track/Sector */
-    gcr_ptr = gcr_buffer;
-    gcr_end = gcr_buffer+track_len;
-    do
-    {
-        if (!find_sync(&gcr_ptr, gcr_end)) return (HEADER_NOT_FOUND);
-        if (gcr_ptr >= gcr_end - 10) return (HEADER_NOT_FOUND);
-        convert_4bytes_from_GCR(gcr_ptr, header);
-        convert_4bytes_from_GCR(gcr_ptr+5, header+4);
-        gcr_ptr++;
-    } while ((header[0]!=0x08) || (header[2]!=sector) || (header[3]!=track));
+    if (index->status == SYNC_NOT_FOUND) return (SYNC_NOT_FOUND);
+
+    /* Try to find block header for Track/Sector.  Sector and track are
+       the last 20 bits of the first GCR group, as GCR codes are unique
+       they can be compared without decoding the headers.  The checksum
+       is left out, so damaged headers are found and decoded as well. */
+    header[0] = 0x08;
+    header[1] = 0x00;
+    header[2] = sector;
+    header[3] = track;
+    convert_4bytes_to_GCR(header, gcr);
+    for (entry = index->header; entry < index->header+index->headers; entry++)
+        if ((entry->gcr[4] == gcr[4]) && (entry->gcr[3] == gcr[3])
+            && ((entry->gcr[2] & 0x0f) == (gcr[2] & 0x0f)))
+            break;
+    if (entry == index->header+index->headers) return (HEADER_NOT_FOUND);
+    convert_bytes_from_GCR(entry->gcr, header, 2, NULL);
 
     error_code = OK;
 
@@ -236,15 +889,15 @@ int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_cycle,
     if ((header[5]!=id[0]) || (header[4]!=id[1]))
         error_code = (error_code == OK) ? ID_MISMATCH : error_code;
 
-    if (!find_sync(&gcr_ptr, gcr_end)) return (DATA_NOT_FOUND);
+    if (entry->data < 0) return (DATA_NOT_FOUND);
 
-    for (i = 0, sectordata = d64_sector; i < 65; i++)
-    {
-        if (gcr_ptr >= gcr_end-5) return (DATA_NOT_FOUND);
-        convert_4bytes_from_GCR(gcr_ptr, sectordata);
-        gcr_ptr += 5;
-        sectordata += 4;
-    }
+    /* decode data block (65 GCR groups), as far as it is in two cycles */
+    groups = (2*index->cycle.track_len-5 - entry->data + 4) / 5;
+    if (groups > 65) groups = 65;
+    if (groups > 0)
+        convert_cycle_from_GCR(&index->cycle, entry->data, d64_sector,
+                               groups, NULL);
+    if (groups < 65) return (DATA_NOT_FOUND);
 
 
     /* check for Block header mark */
@@ -263,11 +916,69 @@ int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_cycle,
 }
 
 
+int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_cycle,
+                       BYTE *d64_sector,
+                       int track, int sector, BYTE *id)
+{
+    struct track_index index;
+
+    if (track > MAX_TRACK_D64) return (0);
+
+    index_GCR_track(gcr_start, gcr_cycle, &index);
+    return (convert_indexed_sector(&index, d64_sector, track, sector, id));
+}
+
+
+/* number of the first D64 block of a track */
+int d64_block_offset(int track)
+{
+    int block;
+    int i;
+
+    for (block = 0, i = 1; i < track; i++)
+        block += sector_map_1541[i];
+    return (block);
+}
+
+
+/* convert all sectors of a GCR track to their place in a D64 image
+
+   The sector data is written to d64_data and the error codes to
+   error_info, both at the offset of the track in the whole image as
+   given by d64_block_offset().  No other state is kept, so the tracks
+   of an image can be converted in any order.
+   Returns the number of sectors with errors.
+*/
+int convert_track_to_d64(BYTE *gcr_start, BYTE *gcr_cycle,
+                         BYTE *d64_data, BYTE *error_info,
+                         int track, BYTE *id)
+{
+    struct track_index index;
+    BYTE rawdata[260];
+    int block;
+    int sector;
+    int errors;
+
+    index_GCR_track(gcr_start, gcr_cycle, &index);
+
+    block = d64_block_offset(track);
+    for (errors = 0, sector = 0; sector < sector_map_1541[track]; sector++)
+    {
+        error_info[block] = convert_indexed_sector(&index, rawdata,
+                                                   track, sector, id);
+        if (error_info[block] != OK) errors++;
+
+        memcpy(d64_data + block*256, rawdata+1, 256);
+        block++;
+    }
+    return (errors);
+}
+
+
 void convert_sector_to_GCR(BYTE *buffer, BYTE *ptr,
                                   int track, int sector, BYTE *diskID)
 {
-    int i;
-    BYTE buf[4];
+    BYTE buf[8];
 
     memset(ptr, 0xff, 5);       /* Sync */
     ptr += 5;
@@ -276,14 +987,11 @@ void convert_sector_to_GCR(BYTE *buffer, BYTE *ptr,
     buf[1] = sector ^ track ^ diskID[1] ^ diskID[0];
     buf[2] = sector;
     buf[3] = track;
-    convert_4bytes_to_GCR(buf, ptr);
-    ptr += 5;
-
-    buf[0] = diskID[1];
-    buf[1] = diskID[2];
-    buf[2] = buf[3] = 0x0f;
-    convert_4bytes_to_GCR(buf, ptr);
-    ptr += 5;
+    buf[4] = diskID[1];
+    buf[5] = diskID[0];
+    buf[6] = buf[7] = 0x0f;
+    convert_bytes_to_GCR(buf, ptr, 2);
+    ptr += 10;
 
     memset(ptr, 0x55, 9);       /* Header Gap */
     ptr += 9;
@@ -291,11 +999,8 @@ void convert_sector_to_GCR(BYTE *buffer, BYTE *ptr,
     memset(ptr, 0xff, 5);       /* Sync */
     ptr += 5;
 
-    for (i = 0; i < 65; i++) {
-        convert_4bytes_to_GCR(buffer, ptr);
-        buffer += 4;
-        ptr += 5;
-    }
+    convert_bytes_to_GCR(buffer, ptr, 65);
+    ptr += 65*5;
 
     /* FIXME: This is approximated.  */
     memset(ptr, 0x55, 6);       /* Gap before next sector.  */
@@ -304,79 +1009,423 @@ void convert_sector_to_GCR(BYTE *buffer, BYTE *ptr,
 }
 
 
-/*
-BYTE* find_track_cycle2(BYTE *start_pos)
+/* synthesize a formatted GCR track from the D64 sectors of one track
+
+   The track is filled up to the nominal length of its speed zone, the
+   remaining space is spread evenly over the gaps between sectors.
+   Returns the length of the GCR track.
+*/
+int convert_track_to_GCR(BYTE *d64_track, BYTE *gcr_track,
+                         int track, BYTE *diskID)
 {
-    BYTE *pos;
-    BYTE *cycle_pos;
-    BYTE *stop_pos;
+    BYTE block[260];
+    BYTE chksum;
+    int sectors, sector;
+    int track_len, gap;
+    int i;
+
+    sectors = sector_map_1541[track];
+    track_len = raw_track_size[speed_map_1541[track - 1]];
+    gap = (track_len - sectors * SECTOR_SIZE_GCR) / sectors;
 
-    pos = start_pos + MIN_TRACK_LENGTH;
-    stop_pos = start_pos+GCR_TRACK_LENGTH-50;
-    cycle_pos = NULL;
+    memset(gcr_track, 0x55, track_len);
+    for (sector = 0; sector < sectors; sector++)
+    {
+        block[0] = 0x07;        /* Block header mark */
+        memcpy(block+1, d64_track + sector*256, 256);
+        for (chksum = 0, i = 1; i < 257; i++)
+            chksum ^= block[i];
+        block[257] = chksum;
+        block[258] = block[259] = 0x00;
+
+        convert_sector_to_GCR(block, gcr_track, track, sector, diskID);
+        gcr_track += SECTOR_SIZE_GCR + gap;
+    }
+    return (track_len);
+}
+
+
+/* start of next reference window for the cycle search: the end of the
+   next sync behind anchor, -1 if there is none */
+static int find_cycle_anchor(BYTE *gcr_track, int anchor)
+{
+    BYTE *gcr_ptr;
 
-    printf("try2!\n");
+    gcr_ptr = gcr_track + anchor + 1;
+    if (!find_sync(&gcr_ptr, gcr_track + GCR_TRACK_LENGTH - MIN_TRACK_LENGTH
+                             - CYCLE_WINDOW))
+        return (-1);
+    return (gcr_ptr - gcr_track);
+}
+
+
+/* best cycle length for the reference window at anchor, see below */
+static int match_cycle(BYTE *gcr_track, int anchor, int *best_match)
+{
+    DWORD hash, ref_hash, factor;
+    BYTE *ref;
+    int pos, end;
+    int len, best_len;
+    int match;
+    int tries;
+    int i;
+
+    ref = gcr_track + anchor;
+    *best_match = 0;
+
+    /* no structure (unformatted or killer track), no cycle */
+    for (i = 1; (i < CYCLE_WINDOW) && (ref[i] == ref[0]); i++);
+    if (i == CYCLE_WINDOW) return (0);
+
+    /* hash = sum of window bytes * CYCLE_HASH^n */
+    for (ref_hash = hash = 0, factor = 1, i = 0; i < CYCLE_WINDOW; i++)
+    {
+        ref_hash = ref_hash * CYCLE_HASH + ref[i];
+        hash = hash * CYCLE_HASH + ref[MIN_TRACK_LENGTH + i];
+        if (i > 0) factor *= CYCLE_HASH;
+    }
 
-    while (pos < stop_pos)
+    best_len = 0;
+    tries = 0;
+    end = GCR_TRACK_LENGTH - CYCLE_WINDOW;
+    for (pos = anchor + MIN_TRACK_LENGTH; pos <= end; pos++)
     {
-		if (memcmp(start_pos, pos, 50) == 0)
+        if ((hash == ref_hash) && (memcmp(ref, gcr_track+pos, CYCLE_WINDOW) == 0))
         {
-            printf("cycle2: %x\n", pos-start_pos);
-            cycle_pos = pos;
-            break;
+            /* count matching bytes of both revolutions */
+            len = pos - anchor;
+            for (match = 0, i = 0; i < GCR_TRACK_LENGTH - len; i++)
+                if (gcr_track[i] == gcr_track[i+len]) match++;
+            match = match * 100 / (GCR_TRACK_LENGTH - len);
+
+            if (match > *best_match)
+            {
+                *best_match = match;
+                best_len = len;
+            }
+            if ((*best_match == 100) || (++tries == CYCLE_TRIES)) break;
         }
-		pos++;
-    }
 
-    return (cycle_pos);
+        if (pos < end)
+            hash = (hash - gcr_track[pos] * factor) * CYCLE_HASH
+                 + gcr_track[pos + CYCLE_WINDOW];
+    }
+    return (best_len);
 }
+
+
+/* find length of the track cycle (one disk revolution) in raw track data
+
+   A rolling hash of a reference window behind a sync is compared against
+   every position in the possible second revolution.  Each position with
+   an equal window is verified by counting the matching bytes of the
+   whole overlap of both revolutions, and the best candidate is taken.
+   If the window is damaged in one revolution the next sync is tried.
+   At most CYCLE_TRIES candidates for CYCLE_ANCHORS windows are verified,
+   so the time stays linear even on tracks of long repeated gaps.
+   Returns the cycle length or 0 if none was found, *confidence is set to
+   the percentage of matching bytes.
 */
+int find_track_cycle_len(BYTE *gcr_track, int *confidence)
+{
+    int anchor;
+    int anchors;
+    int len;
+    int match;
+
+    *confidence = 0;
+    anchor = find_cycle_anchor(gcr_track, -1);
+    if (anchor < 0) anchor = 0;
 
+    for (anchors = 0; (anchors < CYCLE_ANCHORS) && (anchor >= 0); anchors++)
+    {
+        len = match_cycle(gcr_track, anchor, &match);
+        if (match >= CYCLE_MIN_MATCH)
+        {
+            *confidence = match;
+            return (len);
+        }
+        anchor = find_cycle_anchor(gcr_track, anchor);
+    }
+    return (0);
+}
 
 
 BYTE* find_track_cycle(BYTE *start_pos)
 {
-    BYTE *sync_pos;
-    BYTE *cycle_pos;
-    BYTE *stop_pos;
-    BYTE *p1, *p2;
-    BYTE *cycle_try;
+    int cycle_len;
+    int confidence;
 
-    sync_pos = start_pos + MIN_TRACK_LENGTH;
-    stop_pos = start_pos+GCR_TRACK_LENGTH-MATCH_LENGTH; // -MATCH_LENGTH;
-    cycle_pos = NULL;
+    cycle_len = find_track_cycle_len(start_pos, &confidence);
+    return ((cycle_len != 0) ? start_pos + cycle_len : NULL);
+}
 
-    /* try to find next sync */
-    while (find_sync(&sync_pos, stop_pos))
+
+/* rolling hash of CYCLE_WINDOW bytes at pos of a track cycle */
+static DWORD cycle_window_hash(struct track_cycle *cycle, int pos,
+                               BYTE *window)
+{
+    DWORD hash;
+    int i;
+
+    copy_cycle_bytes(cycle, pos, window, CYCLE_WINDOW);
+    for (hash = 0, i = 0; i < CYCLE_WINDOW; i++)
+        hash = hash * CYCLE_HASH + window[i];
+    return (hash);
+}
+
+
+/* rotation of track cycle b against a for the reference window at anchor
+   of a, see below */
+static int match_rotation(struct track_cycle *a, struct track_cycle *b,
+                          int anchor, int *best_match)
+{
+    DWORD hash, ref_hash, factor;
+    BYTE ref[CYCLE_WINDOW], window[CYCLE_WINDOW];
+    BYTE *b_ptr, *b_end;
+    int pos, len, rotation, best_rotation;
+    int match;
+    int tries;
+    int i;
+
+    *best_match = 0;
+    ref_hash = cycle_window_hash(a, anchor, ref);
+
+    /* no structure (unformatted or killer track), no rotation */
+    for (i = 1; (i < CYCLE_WINDOW) && (ref[i] == ref[0]); i++);
+    if (i == CYCLE_WINDOW) return (-1);
+
+    for (factor = 1, i = 1; i < CYCLE_WINDOW; i++) factor *= CYCLE_HASH;
+    hash = cycle_window_hash(b, 0, window);
+
+    len = (a->track_len < b->track_len) ? a->track_len : b->track_len;
+    b_end = b->gcr_start + b->track_len;
+    best_rotation = -1;
+    tries = 0;
+    for (pos = 0; pos < b->track_len; pos++)
     {
-        /* found a sync, now let's see if data matches */
-        p1 = start_pos;
-        cycle_try = sync_pos;
-        for (p2 = sync_pos; p2 < stop_pos;)
+        if (hash == ref_hash)
         {
-            /* try to match all remaining syncs, too */
-            if (memcmp(p1, p2, MATCH_LENGTH) != 0)
+            copy_cycle_bytes(b, pos, window, CYCLE_WINDOW);
+            if (memcmp(ref, window, CYCLE_WINDOW) == 0)
             {
-                cycle_try = NULL;
-                break;
+                /* count matching bytes over the shorter cycle */
+                rotation = (pos - anchor) % b->track_len;
+                if (rotation < 0) rotation += b->track_len;
+                b_ptr = b->gcr_start + rotation;
+                for (match = 0, i = 0; i < len; i++)
+                {
+                    if (a->gcr_start[i] == *b_ptr) match++;
+                    if (++b_ptr == b_end) b_ptr = b->gcr_start;
+                }
+                match = match * 100 / len;
+
+                if (match > *best_match)
+                {
+                    *best_match = match;
+                    best_rotation = rotation;
+                }
+                if ((*best_match == 100) || (++tries == CYCLE_TRIES)) break;
             }
-//            printf("c");
-            if (!find_sync(&p1, stop_pos)) break;
-            if (!find_sync(&p2, stop_pos)) break;
         }
 
-        if (cycle_try != NULL)
+        hash = (hash - b->gcr_start[pos] * factor) * CYCLE_HASH
+             + b->gcr_start[(pos + CYCLE_WINDOW) % b->track_len];
+    }
+    return (best_rotation);
+}
+
+
+/* find the rotation of track cycle b against track cycle a
+
+   Works like find_track_cycle_len(): a rolling hash of a reference
+   window behind a sync of a is compared against every position of b,
+   candidates are verified by counting the matching bytes of both
+   cycles.  The time is linear in the length of the cycles.
+   Returns the position in b of the first byte of a, -1 if none was
+   found.  *confidence is set to the percentage of matching bytes.
+*/
+int find_cycle_rotation(struct track_cycle *a, struct track_cycle *b,
+                        int *confidence)
+{
+    int anchor;
+    int anchors;
+    int rotation;
+    int match;
+
+    *confidence = 0;
+    if ((a->track_len < CYCLE_WINDOW) || (b->track_len < CYCLE_WINDOW))
+        return (-1);
+
+    anchor = 0;
+    if (!find_cycle_sync(a, &anchor, a->track_len)) anchor = 0;
+
+    for (anchors = 0; anchors < CYCLE_ANCHORS; anchors++)
+    {
+        rotation = match_rotation(a, b, anchor, &match);
+        if (match >= CYCLE_MIN_MATCH)
         {
-//            printf("cycle: %x\n", cycle_try-start_pos);
-            cycle_pos = cycle_try;
-            break;
+            *confidence = match;
+            return (rotation);
+        }
+        if (!find_cycle_sync(a, &anchor, a->track_len)) break;
+    }
+    return (-1);
+}
+
+
+/* 64 track bits starting at bit position bitpos, first bit is bit 63.
+   Reads up to 9 bytes starting at byte bitpos/8. */
+static QWORD get_track_bits(BYTE *gcr_track, int bitpos)
+{
+    BYTE *ptr;
+    QWORD bits;
+    int shift;
+
+    ptr = gcr_track + (bitpos >> 3);
+    bits = ((QWORD) ((ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3])
+            << 32)
+         | (DWORD) ((ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7]);
+
+    shift = bitpos & 7;
+    if (shift)
+        bits = (bits << shift) | (ptr[8] >> (8 - shift));
+    return (bits);
+}
+
+
+/* find end of next bit-aligned sync (10 or more one bits)
+
+   *bitpos is the bit position to start from, end is the bit length of
+   the track buffer.  On success *bitpos is set to the first bit behind
+   the sync, which is the first zero bit.
+   The track is scanned one 64-bit word at a time.  Words overlap by 16
+   bits, so a run of 10 one bits is never split between two words.
+*/
+int find_sync_bits(BYTE *gcr_track, int *bitpos, int end)
+{
+    QWORD bits, run;
+    int pos;
+    int i;
+
+    /* find first word holding a run of 10 one bits */
+    for (pos = *bitpos; ; pos += 48)
+    {
+        if (pos + 72 > end) return (0);
+        bits = get_track_bits(gcr_track, pos);
+        run = bits & (bits << 1);   /* bit n set if bits n..n-1 set */
+        run &= run << 2;            /* bits n..n-3 */
+        run &= run << 4;            /* bits n..n-7 */
+        run &= run << 2;            /* bits n..n-9 */
+        if (run) break;
+    }
+
+    /* skip to start of the first run */
+    for (i = 0; !(run >> 63); i++) run <<= 1;
+    pos += i;
+
+    /* skip the one bits of the sync, a byte at a time while possible */
+    do
+    {
+        if (pos + 72 > end) return (0);
+        bits = get_track_bits(gcr_track, pos);
+        for (i = 0; (i < 64) && ((bits >> 56) == 0xff); i += 8) bits <<= 8;
+        for (; (i < 64) && (bits >> 63); i++) bits <<= 1;
+        pos += i;
+    } while (i == 64);
+
+    *bitpos = pos;
+    return (1);
+}
+
+
+/* best cycle length in bits for the reference word at bit anchor */
+static int match_cycle_bits(BYTE *gcr_track, int anchor, int *best_match)
+{
+    QWORD ref, bits;
+    BYTE next;
+    int pos, len, best_len;
+    int words, match;
+    int tries;
+    int shift;
+    int i;
+
+    *best_match = 0;
+    ref = get_track_bits(gcr_track, anchor);
+
+    /* no structure (unformatted or killer track), no cycle */
+    if (ref == ((ref << 8) | (ref >> 56))) return (0);
+
+    best_len = 0;
+    tries = 0;
+    pos = (anchor >> 3) + MIN_TRACK_LENGTH;
+    bits = get_track_bits(gcr_track, pos << 3);
+    for (; pos < GCR_TRACK_LENGTH - 9; pos++)
+    {
+        /* try all 8 bit offsets of the word at this byte */
+        next = gcr_track[pos + 8];
+        for (shift = 0; shift < 8; shift++)
+        {
+            if (((shift == 0) ? bits : ((bits << shift) | (next >> (8 - shift))))
+                != ref)
+                continue;
+
+            len = (pos << 3) + shift - anchor;
+            if (len < (MIN_TRACK_LENGTH << 3)) continue;
+
+            /* count matching words of both revolutions */
+            for (words = match = 0, i = 0;
+                 i + len + 72 <= (GCR_TRACK_LENGTH << 3); i += 64, words++)
+                if (get_track_bits(gcr_track, i)
+                    == get_track_bits(gcr_track, i + len))
+                    match++;
+            match = match * 100 / words;
+
+            if (match > *best_match)
+            {
+                *best_match = match;
+                best_len = len;
+            }
+            if ((*best_match == 100) || (++tries == CYCLE_TRIES))
+                return (best_len);
         }
-          
-//        cycle_pos = (cycle_try != NULL) ? cycle_try : cycle_pos; 
+        bits = (bits << 8) | next;
     }
+    return (best_len);
+}
 
-//    if (cycle_pos == NULL)
-//        cycle_pos = find_track_cycle2(start_pos);
 
-    return (cycle_pos);
+/* find length of the track cycle in bits
+
+   Same as find_track_cycle_len(), but the second revolution may start at
+   any bit offset from the first.  The reference is the 64-bit word
+   behind a bit-aligned sync, it is compared against the track at every
+   bit position of the possible second revolution.
+   Returns the cycle length in bits or 0 if none was found, *confidence
+   is set to the percentage of matching 64-bit words.
+*/
+int find_track_cycle_bits(BYTE *gcr_track, int *confidence)
+{
+    int anchor, end;
+    int anchors;
+    int len;
+    int match;
+
+    *confidence = 0;
+    end = (GCR_TRACK_LENGTH - MIN_TRACK_LENGTH) << 3;
+
+    anchor = 0;
+    if (!find_sync_bits(gcr_track, &anchor, end)) anchor = 0;
+
+    for (anchors = 0; anchors < CYCLE_ANCHORS; anchors++)
+    {
+        len = match_cycle_bits(gcr_track, anchor, &match);
+        if (match >= CYCLE_MIN_MATCH)
+        {
+            *confidence = match;
+            return (len);
+        }
+        if (!find_sync_bits(gcr_track, &anchor, end)) break;
+    }
+    return (0);
 }
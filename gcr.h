@@ -5,14 +5,33 @@
 
     V 0.33   improved sector extraction, added find_track_cycle() function
     V 0.34   added MAX_SYNC_OFFSET constant, approximated to 800 GCR bytes
+    V 0.35   added convert_bytes_from_GCR() bulk decoder
+    V 0.36   added bulk encoder and convert_track_to_GCR()
+    V 0.37   added track index for single scan sector conversion
+    V 0.38   added circular track cycle view
+    V 0.39   added find_track_cycle_len() with match confidence
+    V 0.40   added bit-aligned find_sync_bits() and find_track_cycle_bits()
+    V 0.41   track index keeps block headers GCR encoded
+    V 0.42   added d64_block_offset() and convert_track_to_d64()
+    V 0.43   added GCR_VERSION
+    V 0.44   added find_cycle_rotation() to align two track cycles
+    V 0.45   added init_GCR_decoder()
+    V 0.46   SSE2 and AVX2 decoder kernels in gcr.c
+    V 0.47   init_GCR_decoder() renamed to init_GCR_kernels()
 */
 
 #ifndef _GCR_
 #define _GCR_
 
 
+/* version of the conversion routines in gcr.c, part of the key of
+   cached conversion results, so change it with every change there */
+#define GCR_VERSION 0.47
+
+
 #define BYTE unsigned char
 #define DWORD unsigned int
+#define QWORD unsigned long long
 #define MAX_TRACKS_1541 42
 
 /* D64 constants */
@@ -23,16 +42,28 @@
 
 /* NIB format constants */
 #define GCR_TRACK_LENGTH 0x2000
+#define NIB_TRACK_FAILED 0x80   /* density flag: the track was not read */
+
+/* GCR bytes written per sector by convert_sector_to_GCR() */
+#define SECTOR_SIZE_GCR 360
 
 /* Conversion routines constants */
 #define MIN_TRACK_LENGTH 0x1780
-#define MATCH_LENGTH 7
+/* cycle search: hash window size, hash factor, max. number of windows
+   and of candidates per window to verify, min. percentage of matches */
+#define CYCLE_WINDOW 32
+#define CYCLE_HASH 257
+#define CYCLE_ANCHORS 4
+#define CYCLE_TRIES 32
+#define CYCLE_MIN_MATCH 50
 /* number of GCR bytes until NO SYNC error
    timer counts down from $d000 to $8000 ($20480 cycles)
    until timeout when waiting for a SYNC signal
    This is approx. 20.48 ms, which is approx 1/10th disk revolution
    8000 GCR bytes / 10 = 800 bytes */
 #define MAX_SYNC_OFFSET 800
+/* max. number of block headers in the index of one track */
+#define MAX_TRACK_HEADERS 128
 
 /* Disk Controller error codes */
 #define OK                  0x01
@@ -47,25 +78,97 @@
 #define DISK_NOT_INSERTED   0x0f
 
 
+/* block header found in a GCR track */
+struct sector_header
+{
+    int pos;            /* GCR offset of header block (end of sync) */
+    int data;           /* GCR offset of following data block, -1 if none */
+    int sync_len;       /* number of $ff bytes in front of the header */
+    BYTE gcr[10];       /* header block, still GCR encoded */
+};
+
+/* circular view of a track cycle, see set_track_cycle() */
+struct track_cycle
+{
+    BYTE *gcr_start;    /* start of track cycle */
+    int track_len;      /* length of track cycle */
+};
+
+/* all block headers of a track cycle, see index_GCR_track() */
+struct track_index
+{
+    struct track_cycle cycle;
+    int status;         /* OK, SYNC_NOT_FOUND or 0 if no cycle */
+    int syncs;          /* number of syncs in one cycle */
+    int max_gap;        /* longest distance between syncs */
+    int headers;        /* number of block headers found */
+    struct sector_header header[MAX_TRACK_HEADERS];
+};
+
+
 extern char sector_map_1541[];
 
 extern int speed_map_1541[];
 
+extern int raw_track_size[];
+
 
 void convert_4bytes_to_GCR(BYTE *buffer, BYTE *ptr);
 
+void convert_bytes_to_GCR(BYTE *buffer, BYTE *ptr, int groups);
+
 void convert_4bytes_from_GCR(BYTE *gcr, BYTE *plain);
 
+void init_GCR_kernels(void);
+
+int convert_bytes_from_GCR(BYTE *gcr, BYTE *plain, int groups, BYTE *errmask);
+
 int extract_id(BYTE *gcr_track, BYTE *id);
 
+int find_track_cycle_len(BYTE *gcr_track, int *confidence);
+
 BYTE* find_track_cycle(BYTE *start_pos);
 
+int find_sync_bits(BYTE *gcr_track, int *bitpos, int end);
+
+int find_track_cycle_bits(BYTE *gcr_track, int *confidence);
+
+void set_track_cycle(struct track_cycle *cycle,
+                     BYTE *gcr_start, BYTE *gcr_cycle);
+
+int find_cycle_sync(struct track_cycle *cycle, int *pos, int end);
+
+void copy_cycle_bytes(struct track_cycle *cycle, int pos,
+                      BYTE *dest, int len);
+
+int convert_cycle_from_GCR(struct track_cycle *cycle, int pos,
+                           BYTE *plain, int groups, BYTE *errmask);
+
+int find_cycle_rotation(struct track_cycle *a, struct track_cycle *b,
+                        int *confidence);
+
+int index_GCR_track(BYTE *gcr_start, BYTE *gcr_cycle,
+                    struct track_index *index);
+
+int convert_indexed_sector(struct track_index *index,
+                           BYTE *d64_sector,
+                           int track, int sector, BYTE *id);
+
 int convert_GCR_sector(BYTE *gcr_start, BYTE *gcr_end,
                        BYTE *d64_sector,
                        int track, int sector, BYTE *id);
 
+int d64_block_offset(int track);
+
+int convert_track_to_d64(BYTE *gcr_start, BYTE *gcr_cycle,
+                         BYTE *d64_data, BYTE *error_info,
+                         int track, BYTE *id);
+
 void convert_sector_to_GCR(BYTE *buffer, BYTE *ptr,
                                   int track, int sector, BYTE *diskID);
 
+int convert_track_to_GCR(BYTE *d64_track, BYTE *gcr_track,
+                         int track, BYTE *diskID);
+
 
 #endif
@@ -0,0 +1,171 @@
+/* gcr_tab.h - generated by mkgcrtab, do not edit */
+
+/* GCR quintet pair to byte conversion table, see mkgcrtab.c */
+static unsigned short GCR_decode_pair[1024] =
+{
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x088, 0x080, 0x081, 0x1ff, 0x08c, 0x084, 0x085,
+    0x1ff, 0x1ff, 0x082, 0x083, 0x1ff, 0x08f, 0x086, 0x087,
+    0x1ff, 0x089, 0x08a, 0x08b, 0x1ff, 0x08d, 0x08e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x008, 0x000, 0x001, 0x1ff, 0x00c, 0x004, 0x005,
+    0x1ff, 0x1ff, 0x002, 0x003, 0x1ff, 0x00f, 0x006, 0x007,
+    0x1ff, 0x009, 0x00a, 0x00b, 0x1ff, 0x00d, 0x00e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x018, 0x010, 0x011, 0x1ff, 0x01c, 0x014, 0x015,
+    0x1ff, 0x1ff, 0x012, 0x013, 0x1ff, 0x01f, 0x016, 0x017,
+    0x1ff, 0x019, 0x01a, 0x01b, 0x1ff, 0x01d, 0x01e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0c8, 0x0c0, 0x0c1, 0x1ff, 0x0cc, 0x0c4, 0x0c5,
+    0x1ff, 0x1ff, 0x0c2, 0x0c3, 0x1ff, 0x0cf, 0x0c6, 0x0c7,
+    0x1ff, 0x0c9, 0x0ca, 0x0cb, 0x1ff, 0x0cd, 0x0ce, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x048, 0x040, 0x041, 0x1ff, 0x04c, 0x044, 0x045,
+    0x1ff, 0x1ff, 0x042, 0x043, 0x1ff, 0x04f, 0x046, 0x047,
+    0x1ff, 0x049, 0x04a, 0x04b, 0x1ff, 0x04d, 0x04e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x058, 0x050, 0x051, 0x1ff, 0x05c, 0x054, 0x055,
+    0x1ff, 0x1ff, 0x052, 0x053, 0x1ff, 0x05f, 0x056, 0x057,
+    0x1ff, 0x059, 0x05a, 0x05b, 0x1ff, 0x05d, 0x05e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x028, 0x020, 0x021, 0x1ff, 0x02c, 0x024, 0x025,
+    0x1ff, 0x1ff, 0x022, 0x023, 0x1ff, 0x02f, 0x026, 0x027,
+    0x1ff, 0x029, 0x02a, 0x02b, 0x1ff, 0x02d, 0x02e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x038, 0x030, 0x031, 0x1ff, 0x03c, 0x034, 0x035,
+    0x1ff, 0x1ff, 0x032, 0x033, 0x1ff, 0x03f, 0x036, 0x037,
+    0x1ff, 0x039, 0x03a, 0x03b, 0x1ff, 0x03d, 0x03e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0f8, 0x0f0, 0x0f1, 0x1ff, 0x0fc, 0x0f4, 0x0f5,
+    0x1ff, 0x1ff, 0x0f2, 0x0f3, 0x1ff, 0x0ff, 0x0f6, 0x0f7,
+    0x1ff, 0x0f9, 0x0fa, 0x0fb, 0x1ff, 0x0fd, 0x0fe, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x068, 0x060, 0x061, 0x1ff, 0x06c, 0x064, 0x065,
+    0x1ff, 0x1ff, 0x062, 0x063, 0x1ff, 0x06f, 0x066, 0x067,
+    0x1ff, 0x069, 0x06a, 0x06b, 0x1ff, 0x06d, 0x06e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x078, 0x070, 0x071, 0x1ff, 0x07c, 0x074, 0x075,
+    0x1ff, 0x1ff, 0x072, 0x073, 0x1ff, 0x07f, 0x076, 0x077,
+    0x1ff, 0x079, 0x07a, 0x07b, 0x1ff, 0x07d, 0x07e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x098, 0x090, 0x091, 0x1ff, 0x09c, 0x094, 0x095,
+    0x1ff, 0x1ff, 0x092, 0x093, 0x1ff, 0x09f, 0x096, 0x097,
+    0x1ff, 0x099, 0x09a, 0x09b, 0x1ff, 0x09d, 0x09e, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0a8, 0x0a0, 0x0a1, 0x1ff, 0x0ac, 0x0a4, 0x0a5,
+    0x1ff, 0x1ff, 0x0a2, 0x0a3, 0x1ff, 0x0af, 0x0a6, 0x0a7,
+    0x1ff, 0x0a9, 0x0aa, 0x0ab, 0x1ff, 0x0ad, 0x0ae, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0b8, 0x0b0, 0x0b1, 0x1ff, 0x0bc, 0x0b4, 0x0b5,
+    0x1ff, 0x1ff, 0x0b2, 0x0b3, 0x1ff, 0x0bf, 0x0b6, 0x0b7,
+    0x1ff, 0x0b9, 0x0ba, 0x0bb, 0x1ff, 0x0bd, 0x0be, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0d8, 0x0d0, 0x0d1, 0x1ff, 0x0dc, 0x0d4, 0x0d5,
+    0x1ff, 0x1ff, 0x0d2, 0x0d3, 0x1ff, 0x0df, 0x0d6, 0x0d7,
+    0x1ff, 0x0d9, 0x0da, 0x0db, 0x1ff, 0x0dd, 0x0de, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x0e8, 0x0e0, 0x0e1, 0x1ff, 0x0ec, 0x0e4, 0x0e5,
+    0x1ff, 0x1ff, 0x0e2, 0x0e3, 0x1ff, 0x0ef, 0x0e6, 0x0e7,
+    0x1ff, 0x0e9, 0x0ea, 0x0eb, 0x1ff, 0x0ed, 0x0ee, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff,
+    0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff, 0x1ff
+};
+
+/* byte to GCR quintet pair conversion table, see mkgcrtab.c */
+static unsigned short GCR_encode_pair[256] =
+{
+    0x14a, 0x14b, 0x152, 0x153, 0x14e, 0x14f, 0x156, 0x157,
+    0x149, 0x159, 0x15a, 0x15b, 0x14d, 0x15d, 0x15e, 0x155,
+    0x16a, 0x16b, 0x172, 0x173, 0x16e, 0x16f, 0x176, 0x177,
+    0x169, 0x179, 0x17a, 0x17b, 0x16d, 0x17d, 0x17e, 0x175,
+    0x24a, 0x24b, 0x252, 0x253, 0x24e, 0x24f, 0x256, 0x257,
+    0x249, 0x259, 0x25a, 0x25b, 0x24d, 0x25d, 0x25e, 0x255,
+    0x26a, 0x26b, 0x272, 0x273, 0x26e, 0x26f, 0x276, 0x277,
+    0x269, 0x279, 0x27a, 0x27b, 0x26d, 0x27d, 0x27e, 0x275,
+    0x1ca, 0x1cb, 0x1d2, 0x1d3, 0x1ce, 0x1cf, 0x1d6, 0x1d7,
+    0x1c9, 0x1d9, 0x1da, 0x1db, 0x1cd, 0x1dd, 0x1de, 0x1d5,
+    0x1ea, 0x1eb, 0x1f2, 0x1f3, 0x1ee, 0x1ef, 0x1f6, 0x1f7,
+    0x1e9, 0x1f9, 0x1fa, 0x1fb, 0x1ed, 0x1fd, 0x1fe, 0x1f5,
+    0x2ca, 0x2cb, 0x2d2, 0x2d3, 0x2ce, 0x2cf, 0x2d6, 0x2d7,
+    0x2c9, 0x2d9, 0x2da, 0x2db, 0x2cd, 0x2dd, 0x2de, 0x2d5,
+    0x2ea, 0x2eb, 0x2f2, 0x2f3, 0x2ee, 0x2ef, 0x2f6, 0x2f7,
+    0x2e9, 0x2f9, 0x2fa, 0x2fb, 0x2ed, 0x2fd, 0x2fe, 0x2f5,
+    0x12a, 0x12b, 0x132, 0x133, 0x12e, 0x12f, 0x136, 0x137,
+    0x129, 0x139, 0x13a, 0x13b, 0x12d, 0x13d, 0x13e, 0x135,
+    0x32a, 0x32b, 0x332, 0x333, 0x32e, 0x32f, 0x336, 0x337,
+    0x329, 0x339, 0x33a, 0x33b, 0x32d, 0x33d, 0x33e, 0x335,
+    0x34a, 0x34b, 0x352, 0x353, 0x34e, 0x34f, 0x356, 0x357,
+    0x349, 0x359, 0x35a, 0x35b, 0x34d, 0x35d, 0x35e, 0x355,
+    0x36a, 0x36b, 0x372, 0x373, 0x36e, 0x36f, 0x376, 0x377,
+    0x369, 0x379, 0x37a, 0x37b, 0x36d, 0x37d, 0x37e, 0x375,
+    0x1aa, 0x1ab, 0x1b2, 0x1b3, 0x1ae, 0x1af, 0x1b6, 0x1b7,
+    0x1a9, 0x1b9, 0x1ba, 0x1bb, 0x1ad, 0x1bd, 0x1be, 0x1b5,
+    0x3aa, 0x3ab, 0x3b2, 0x3b3, 0x3ae, 0x3af, 0x3b6, 0x3b7,
+    0x3a9, 0x3b9, 0x3ba, 0x3bb, 0x3ad, 0x3bd, 0x3be, 0x3b5,
+    0x3ca, 0x3cb, 0x3d2, 0x3d3, 0x3ce, 0x3cf, 0x3d6, 0x3d7,
+    0x3c9, 0x3d9, 0x3da, 0x3db, 0x3cd, 0x3dd, 0x3de, 0x3d5,
+    0x2aa, 0x2ab, 0x2b2, 0x2b3, 0x2ae, 0x2af, 0x2b6, 0x2b7,
+    0x2a9, 0x2b9, 0x2ba, 0x2bb, 0x2ad, 0x2bd, 0x2be, 0x2b5
+};
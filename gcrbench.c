@@ -0,0 +1,228 @@
+/* gcrbench - checks and times the GCR conversion routines of gcr.c
+
+    (C) 2026 mnib contributors
+
+    Encodes the sectors of a whole disk with convert_4bytes_to_GCR(),
+    the encoder up to gcr.c V 0.35, and with convert_bytes_to_GCR(),
+    first with its default kernel and then with the one picked by
+    init_GCR_kernels().  The GCR data is decoded back the same way with
+    convert_4bytes_from_GCR() and convert_bytes_from_GCR().  All of them
+    must give the same bytes, the time per 4 byte group is printed.
+    Then each track is synthesized by convert_track_to_GCR() and all
+    its sectors are read back by convert_GCR_sector().
+
+    Usage: gcrbench [runs]
+
+    V 0.10   first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gcr.h"
+
+#define VERSION 0.10
+
+/* default number of passes over the disk */
+#define RUNS 200
+
+/* 4 byte groups in the sectors of a disk, 65 per sector */
+#define DISK_GROUPS (BLOCKSONDISK * 65)
+
+
+static unsigned int seed = 1;
+
+static BYTE next_random(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16);
+}
+
+
+/* nanoseconds per group of a number of runs over the disk */
+static double group_time(clock_t elapsed, int runs)
+{
+    return ((double) elapsed * 1e9 / CLOCKS_PER_SEC
+            / ((double) runs * DISK_GROUPS));
+}
+
+
+static double time_old_encoder(BYTE *plain, BYTE *gcr, int runs)
+{
+    clock_t start;
+    int i, group;
+
+    start = clock();
+    for (i = 0; i < runs; i++)
+        for (group = 0; group < DISK_GROUPS; group++)
+            convert_4bytes_to_GCR(plain + group*4, gcr + group*5);
+    return (group_time(clock() - start, runs));
+}
+
+
+static double time_bulk_encoder(BYTE *plain, BYTE *gcr, int runs)
+{
+    clock_t start;
+    int i;
+
+    start = clock();
+    for (i = 0; i < runs; i++)
+        convert_bytes_to_GCR(plain, gcr, DISK_GROUPS);
+    return (group_time(clock() - start, runs));
+}
+
+
+static double time_old_decoder(BYTE *gcr, BYTE *plain, int runs)
+{
+    clock_t start;
+    int i, group;
+
+    start = clock();
+    for (i = 0; i < runs; i++)
+        for (group = 0; group < DISK_GROUPS; group++)
+            convert_4bytes_from_GCR(gcr + group*5, plain + group*4);
+    return (group_time(clock() - start, runs));
+}
+
+
+static double time_bulk_decoder(BYTE *gcr, BYTE *plain, int runs)
+{
+    clock_t start;
+    int i;
+
+    start = clock();
+    for (i = 0; i < runs; i++)
+        convert_bytes_from_GCR(gcr, plain, DISK_GROUPS, NULL);
+    return (group_time(clock() - start, runs));
+}
+
+
+/* compare a result with the reference, report the first difference */
+static int same_bytes(char *name, BYTE *result, BYTE *reference, int len)
+{
+    int i;
+
+    for (i = 0; (i < len) && (result[i] == reference[i]); i++);
+    if (i == len) return (1);
+
+    fprintf(stderr, "%s differs at byte %d: %02x, not %02x\n",
+            name, i, result[i], reference[i]);
+    return (0);
+}
+
+
+/* synthesize every track and read all sectors back */
+static int check_tracks(BYTE *d64data)
+{
+    BYTE gcr_track[GCR_TRACK_LENGTH];
+    BYTE sector_data[260];
+    BYTE diskID[2];
+    BYTE *d64_track;
+    int track, sector;
+    int track_len;
+    int error;
+    int errors;
+
+    diskID[0] = 0x39;
+    diskID[1] = 0x30;
+
+    errors = 0;
+    for (track = 1; track <= 35; track++)
+    {
+        d64_track = d64data + d64_block_offset(track) * 256;
+        track_len = convert_track_to_GCR(d64_track, gcr_track,
+                                         track, diskID);
+
+        for (sector = 0; sector < sector_map_1541[track]; sector++)
+        {
+            error = convert_GCR_sector(gcr_track, gcr_track + track_len,
+                                       sector_data, track, sector, diskID);
+            if ((error != OK)
+                || (memcmp(sector_data + 1, d64_track + sector*256, 256)))
+            {
+                fprintf(stderr, "Track %d sector %d not read back, "
+                                "error %d\n", track, sector, error);
+                errors++;
+            }
+        }
+    }
+    return (errors);
+}
+
+
+int main(int argc, char **argv)
+{
+    BYTE *plain, *gcr, *reference, *result;
+    double old_encode, default_encode, fastest_encode;
+    double old_decode, default_decode, fastest_decode;
+    int runs;
+    int errors;
+    int i;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "gcrbench %.2f\nUsage: gcrbench [runs]\n",
+                VERSION);
+        exit (-1);
+    }
+    runs = (argc == 2) ? atoi(argv[1]) : RUNS;
+    if (runs < 1) runs = 1;
+
+    plain = malloc(DISK_GROUPS * 4);
+    result = malloc(DISK_GROUPS * 4);
+    gcr = malloc(DISK_GROUPS * 5);
+    reference = malloc(DISK_GROUPS * 5);
+    if ((plain == NULL) || (result == NULL)
+        || (gcr == NULL) || (reference == NULL))
+    {
+        fprintf(stderr, "Cannot allocate buffers.\n");
+        exit (-1);
+    }
+
+    for (i = 0; i < DISK_GROUPS * 4; i++) plain[i] = next_random();
+
+    errors = 0;
+    printf("%d runs over %d groups, ns per group:\n", runs, DISK_GROUPS);
+
+    /* old routines and default kernels */
+    old_encode = time_old_encoder(plain, reference, runs);
+    default_encode = time_bulk_encoder(plain, gcr, runs);
+    if (!same_bytes("Default encoder", gcr, reference, DISK_GROUPS * 5))
+        errors++;
+    old_decode = time_old_decoder(reference, result, runs);
+    if (!same_bytes("Old decoder", result, plain, DISK_GROUPS * 4))
+        errors++;
+    memset(result, 0, DISK_GROUPS * 4);
+    default_decode = time_bulk_decoder(reference, result, runs);
+    if (!same_bytes("Default decoder", result, plain, DISK_GROUPS * 4))
+        errors++;
+
+    /* kernels picked for this machine */
+    init_GCR_kernels();
+    memset(gcr, 0, DISK_GROUPS * 5);
+    fastest_encode = time_bulk_encoder(plain, gcr, runs);
+    if (!same_bytes("Fastest encoder", gcr, reference, DISK_GROUPS * 5))
+        errors++;
+    memset(result, 0, DISK_GROUPS * 4);
+    fastest_decode = time_bulk_decoder(reference, result, runs);
+    if (!same_bytes("Fastest decoder", result, plain, DISK_GROUPS * 4))
+        errors++;
+
+    printf("encode: %6.2f old, %6.2f default, %6.2f fastest (%.1fx)\n",
+           old_encode, default_encode, fastest_encode,
+           old_encode / fastest_encode);
+    printf("decode: %6.2f old, %6.2f default, %6.2f fastest (%.1fx)\n",
+           old_decode, default_decode, fastest_decode,
+           old_decode / fastest_decode);
+
+    errors += check_tracks(plain);
+
+    if (errors)
+    {
+        printf("%d errors\n", errors);
+        return (-1);
+    }
+    printf("all results identical\n");
+    return (0);
+}
@@ -0,0 +1,571 @@
+/* image.c - reading NIB, NBZ and G64 disk images, writing G64 images
+
+    (C) 2026 mnib contributors
+
+    NIB: 0x100 byte header "MNIB-1541-RAW", at offset 0x10 one entry
+         (halftrack, density) per stored track, then 0x2000 bytes of
+         GCR data per track in the order of the header entries.
+         The whole image is read with a single fread(), tracks are
+         handed out as pointers into the image data.
+    NBZ: packed NIB image, see nbz.c.  The whole image is read like a
+         NIB image, a track is unpacked on its first use.
+    Streaming NIB: 0x10 byte header "MNIB-1541-STR", then each track
+         as its NIB header entry (halftrack, density) followed by
+         0x2000 bytes of GCR data, ended by a 0 halftrack.  This is
+         written by mnib to stdout or a pipe while it reads the disk.
+         The name "-" reads it from stdin.  Tracks are read when a
+         halftrack is asked for, so converting a track can start as
+         soon as it arrives.  Halftracks are expected in ascending
+         order, a halftrack below the last one read is missing.
+    G64: 12 byte header "GCR-1541" (version, number of halftracks,
+         max. track size), then a table of track offsets and a table
+         of speed zones with one DWORD per halftrack, starting at
+         track 1.  An offset of 0 means the halftrack is not stored.
+         Each track is a length word followed by the GCR data.  Only
+         the tables are read on open, a track is read on its first
+         use.  Tracks need not be at fixed places or of fixed size.
+
+         G64 images are written compact: each track takes its length
+         word and its real cycle length only, halftracks that are not
+         stored have offset 0 and all blank tracks of the same length
+         share one copy.
+
+    V 0.10   first version, whole image is read with one fread()
+    V 0.11   G64 tracks are found by the offset table and read on demand
+    V 0.12   added compact G64 writer
+    V 0.13   added packed NIB images (NBZ)
+    V 0.14   added streaming NIB images, read from stdin or a pipe
+    V 0.15   added image_track_failed()
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__DJGPP__)
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "image.h"
+#include "nbz.h"
+
+
+static DWORD get_dword(BYTE *ptr)
+{
+    return (ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((DWORD) ptr[3] << 24));
+}
+
+
+/* read the G64 header and tables, returns 1 on success */
+static int open_g64(struct disk_image *image, char *name)
+{
+    BYTE header[G64_HEADER_SIZE];
+    BYTE table[G64_HALFTRACKS * 4];
+    int i;
+
+    fseek(image->fp, 0, SEEK_SET);
+    if (fread(header, G64_HEADER_SIZE, 1, image->fp) != 1)
+    {
+        fprintf(stderr, "Cannot read header from image %s.\n", name);
+        return (0);
+    }
+
+    image->halftracks = header[9];
+    if (image->halftracks > G64_HALFTRACKS)
+        image->halftracks = G64_HALFTRACKS;
+
+    if (fread(table, image->halftracks * 4, 1, image->fp) != 1)
+    {
+        fprintf(stderr, "Cannot read track offsets from image %s.\n", name);
+        return (0);
+    }
+    for (i = 0; i < image->halftracks; i++)
+        image->track_offset[i] = get_dword(table + i*4);
+
+    /* speed table follows the offsets of all halftracks in the header */
+    fseek(image->fp, G64_HEADER_SIZE + header[9] * 4, SEEK_SET);
+    if (fread(table, image->halftracks * 4, 1, image->fp) != 1)
+    {
+        fprintf(stderr, "Cannot read speed zones from image %s.\n", name);
+        return (0);
+    }
+    for (i = 0; i < image->halftracks; i++)
+        image->speed[i] = get_dword(table + i*4);
+
+    return (1);
+}
+
+
+/* open a NIB, NBZ, streaming NIB or G64 image, "-" is stdin
+   Returns 1 on success, 0 on failure. */
+int open_image(struct disk_image *image, char *name)
+{
+    BYTE magic[STREAM_HEADER_SIZE];
+
+    memset(image, 0, sizeof(struct disk_image));
+
+    if (strcmp(name, "-") == 0)
+    {
+        image->fp = stdin;
+#if defined(__DJGPP__)
+        setmode(fileno(stdin), O_BINARY);
+#endif
+    }
+    else
+        image->fp = fopen(name, "rb");
+    if (image->fp == NULL)
+    {
+        fprintf(stderr, "Cannot open image %s.\n", name);
+        return (0);
+    }
+
+    /* only read from the start, pipes cannot seek */
+    if (fread(magic, STREAM_HEADER_SIZE, 1, image->fp) != 1)
+    {
+        fprintf(stderr, "Cannot read header from image %s.\n", name);
+        close_image(image);
+        return (0);
+    }
+    if (memcmp(magic, STREAM_MAGIC, strlen(STREAM_MAGIC)) == 0)
+    {
+        image->type = IMAGE_STREAM;
+        return (1);
+    }
+    if (image->fp == stdin)
+    {
+        fprintf(stderr, "Only streaming NIB images can be read from stdin.\n");
+        close_image(image);
+        return (0);
+    }
+
+    fseek(image->fp, 0, SEEK_END);
+    image->size = ftell(image->fp);
+    fseek(image->fp, 0, SEEK_SET);
+
+    if (memcmp(magic, "GCR-1541", 8) == 0)
+    {
+        image->type = IMAGE_G64;
+        if (open_g64(image, name)) return (1);
+        close_image(image);
+        return (0);
+    }
+
+    image->type = IMAGE_NIB;
+    if (image->size < 0x100)
+    {
+        fprintf(stderr, "Cannot read header from image %s.\n", name);
+        close_image(image);
+        return (0);
+    }
+
+    image->data = malloc(image->size);
+    if (image->data == NULL)
+    {
+        fprintf(stderr, "Out of memory reading image %s.\n", name);
+        close_image(image);
+        return (0);
+    }
+
+    fseek(image->fp, 0, SEEK_SET);
+    if (fread(image->data, image->size, 1, image->fp) != 1)
+    {
+        fprintf(stderr, "Cannot read image %s.\n", name);
+        close_image(image);
+        return (0);
+    }
+    fclose(image->fp);
+    image->fp = NULL;
+
+    if (memcmp(image->data, NBZ_MAGIC, strlen(NBZ_MAGIC)) == 0)
+    {
+        image->type = IMAGE_NBZ;
+        if (image->size < NBZ_HEADER_SIZE + NBZ_INDEX_SIZE)
+        {
+            fprintf(stderr, "Cannot read track index from image %s.\n",
+                    name);
+            close_image(image);
+            return (0);
+        }
+    }
+
+    return (1);
+}
+
+
+/* position of a halftrack in the track list of a NIB header, -1 if none */
+static int nib_track_entry(struct disk_image *image, int halftrack)
+{
+    int entry;
+
+    for (entry = 0; 0x10 + entry*2 < 0x100; entry++)
+    {
+        if (image->data[0x10 + entry*2] == 0) break;
+        if (image->data[0x10 + entry*2] == halftrack) return (entry);
+    }
+    return (-1);
+}
+
+
+/* read a G64 track on first use
+
+   The buffer holds at least GCR_TRACK_LENGTH bytes, behind the track
+   data the track is repeated like in a NIB track.  So functions that
+   scan a whole NIB track, like extract_id(), can be used on it.
+*/
+static BYTE *load_g64_track(struct disk_image *image, int entry)
+{
+    BYTE length[2];
+    BYTE *track;
+    int track_len, size;
+    int i;
+
+    if (image->track[entry] != NULL) return (image->track[entry]);
+    if (image->track_offset[entry] == 0) return (NULL);
+
+    if ((fseek(image->fp, image->track_offset[entry], SEEK_SET) != 0)
+        || (fread(length, 2, 1, image->fp) != 1))
+        return (NULL);
+
+    track_len = length[0] | (length[1] << 8);
+    if (track_len == 0) return (NULL);
+
+    size = (track_len > GCR_TRACK_LENGTH) ? track_len : GCR_TRACK_LENGTH;
+    track = malloc(size);
+    if (track == NULL) return (NULL);
+
+    if (fread(track, track_len, 1, image->fp) != 1)
+    {
+        free(track);
+        return (NULL);
+    }
+    for (i = track_len; i < size; i++)
+        track[i] = track[i - track_len];
+
+    image->track[entry] = track;
+    image->track_len[entry] = track_len;
+    return (track);
+}
+
+
+/* read a streaming NIB up to the given halftrack
+   Tracks are kept by halftrack as they arrive, the stream is read until
+   the halftrack or a higher one was read or the stream ended. */
+static void read_stream(struct disk_image *image, int halftrack)
+{
+    BYTE entry[2];
+    BYTE *track;
+
+    while (!image->stream_end && (image->last_halftrack < halftrack))
+    {
+        if ((fread(entry, 2, 1, image->fp) != 1) || (entry[0] == 0))
+        {
+            image->stream_end = 1;
+            break;
+        }
+
+        track = malloc(GCR_TRACK_LENGTH);
+        if ((track == NULL)
+            || (fread(track, GCR_TRACK_LENGTH, 1, image->fp) != 1))
+        {
+            fprintf(stderr, "Cannot read track %d from stream.\n",
+                    entry[0] / 2);
+            if (track != NULL) free(track);
+            image->stream_end = 1;
+            break;
+        }
+
+        image->last_halftrack = entry[0];
+        if ((entry[0] < 2) || (entry[0] >= 2 + G64_HALFTRACKS)
+            || (image->track[entry[0] - 2] != NULL))
+        {
+            free(track);
+            continue;
+        }
+        image->track[entry[0] - 2] = track;
+        image->track_len[entry[0] - 2] = GCR_TRACK_LENGTH;
+        image->speed[entry[0] - 2] = entry[1];
+    }
+}
+
+
+/* unpack a NBZ track on first use */
+static BYTE *load_nbz_track(struct disk_image *image, int halftrack)
+{
+    BYTE *track;
+    long offset;
+    int entry;
+
+    entry = nib_track_entry(image, halftrack);
+    if ((entry < 0) || (entry >= NBZ_TRACKS)) return (NULL);
+    if (image->track[halftrack - 2] != NULL)
+        return (image->track[halftrack - 2]);
+
+    offset = get_dword(image->data + NBZ_HEADER_SIZE + entry*4);
+    if ((offset == 0) || (offset >= image->size)) return (NULL);
+
+    track = malloc(GCR_TRACK_LENGTH);
+    if (track == NULL) return (NULL);
+
+    if (!unpack_track(image->data + offset, image->size - offset, track))
+    {
+        fprintf(stderr, "Packed track %d.%d is damaged.\n",
+                halftrack / 2, (halftrack & 1) * 5);
+        free(track);
+        return (NULL);
+    }
+
+    image->track[halftrack - 2] = track;
+    image->track_len[halftrack - 2] = GCR_TRACK_LENGTH;
+    return (track);
+}
+
+
+/* pointer to the GCR data of a halftrack (2 = track 1) in the image
+
+   *track_len is set to the number of GCR bytes: GCR_TRACK_LENGTH for
+   NIB and NBZ images, the stored track length for G64 images.
+   Returns NULL if the halftrack is not in the image.
+*/
+BYTE *image_track(struct disk_image *image, int halftrack, int *track_len)
+{
+    BYTE *track;
+    long offset;
+    int entry;
+
+    if (image->type == IMAGE_G64)
+    {
+        entry = halftrack - 2;
+        if ((entry < 0) || (entry >= image->halftracks)) return (NULL);
+
+        track = load_g64_track(image, entry);
+        if (track != NULL) *track_len = image->track_len[entry];
+        return (track);
+    }
+
+    if (image->type == IMAGE_STREAM)
+    {
+        if ((halftrack < 2) || (halftrack >= 2 + G64_HALFTRACKS))
+            return (NULL);
+
+        read_stream(image, halftrack);
+        track = image->track[halftrack - 2];
+        if (track != NULL) *track_len = GCR_TRACK_LENGTH;
+        return (track);
+    }
+
+    if (image->type == IMAGE_NBZ)
+    {
+        if ((halftrack < 2) || (halftrack >= 2 + G64_HALFTRACKS))
+            return (NULL);
+
+        track = load_nbz_track(image, halftrack);
+        if (track != NULL) *track_len = GCR_TRACK_LENGTH;
+        return (track);
+    }
+
+    entry = nib_track_entry(image, halftrack);
+    if (entry < 0) return (NULL);
+
+    offset = 0x100 + (long) entry * GCR_TRACK_LENGTH;
+    if (offset + GCR_TRACK_LENGTH > image->size) return (NULL);
+
+    *track_len = GCR_TRACK_LENGTH;
+    return (image->data + offset);
+}
+
+
+/* density of a halftrack: the NIB density byte or the G64 speed zone,
+   0 if the halftrack is unknown */
+int image_density(struct disk_image *image, int halftrack)
+{
+    int entry;
+
+    if (image->type == IMAGE_G64)
+    {
+        entry = halftrack - 2;
+        if ((entry < 0) || (entry >= image->halftracks)) return (0);
+        return (image->speed[entry]);
+    }
+
+    if (image->type == IMAGE_STREAM)
+    {
+        entry = halftrack - 2;
+        if ((entry < 0) || (entry >= G64_HALFTRACKS)) return (0);
+        read_stream(image, halftrack);
+        return (image->speed[entry]);
+    }
+
+    entry = nib_track_entry(image, halftrack);
+    if (entry < 0) return (0);
+    return (image->data[0x10 + entry*2 + 1]);
+}
+
+/* did mnib fail to read the halftrack?  Its data must not be used then,
+   see NIB_TRACK_FAILED.  G64 images have no such flag. */
+int image_track_failed(struct disk_image *image, int halftrack)
+{
+    if (image->type == IMAGE_G64) return (0);
+    return ((image_density(image, halftrack) & NIB_TRACK_FAILED) != 0);
+}
+
+void close_image(struct disk_image *image)
+{
+    int i;
+
+    for (i = 0; i < G64_HALFTRACKS; i++)
+    {
+        if (image->track[i] != NULL) free(image->track[i]);
+        image->track[i] = NULL;
+    }
+    if (image->data != NULL) free(image->data);
+    image->data = NULL;
+    if ((image->fp != NULL) && (image->fp != stdin)) fclose(image->fp);
+    image->fp = NULL;
+    image->size = 0;
+}
+
+
+static int write_dword(FILE *fd, DWORD *buf, int num)
+{
+    int i;
+    BYTE *tmpbuf;
+
+    tmpbuf = malloc(num);
+    if (tmpbuf == NULL) return -1;
+
+    for (i = 0; i < (num / 4); i++) {
+        tmpbuf[i * 4] = buf[i] & 0xff;
+        tmpbuf[i * 4 + 1] = (buf[i] >> 8) & 0xff;
+        tmpbuf[i * 4 + 2] = (buf[i] >> 16) & 0xff;
+        tmpbuf[i * 4 + 3] = (buf[i] >> 24) & 0xff;
+    }
+
+    if (fwrite((char *)tmpbuf, num, 1, fd) < 1) {
+        free(tmpbuf);
+        return -1;
+    }
+    free(tmpbuf);
+    return 0;
+}
+
+
+/* start a G64 image, the tables are written by close_g64()
+   Returns 1 on success, 0 on failure. */
+int create_g64(struct g64_writer *g64, char *name)
+{
+    memset(g64, 0, sizeof(struct g64_writer));
+
+    g64->fp = fopen(name, "wb");
+    if (g64->fp == NULL)
+    {
+        fprintf(stderr, "Cannot open G64 image %s.\n", name);
+        return (0);
+    }
+
+    /* tracks follow the header and both tables */
+    g64->pos = G64_HEADER_SIZE + G64_HALFTRACKS * 8;
+    g64->max_len = G64_TRACK_SLOT - 2;
+    return (1);
+}
+
+
+/* append a track to a G64 image
+
+   gcr_track == NULL writes a blank track (a sync followed by $55 bytes)
+   of track_len bytes, blank tracks of equal length are stored once.
+   Returns 1 on success, 0 on failure.
+*/
+int write_g64_track(struct g64_writer *g64, int halftrack,
+                    BYTE *gcr_track, int track_len, int speed)
+{
+    BYTE length[2];
+    BYTE *blank;
+    int entry;
+    int i;
+
+    entry = halftrack - 2;
+    if ((entry < 0) || (entry >= G64_HALFTRACKS)) return (0);
+    g64->speed[entry] = speed;
+
+    if (gcr_track == NULL)
+    {
+        for (i = 0; (i < 4) && (g64->blank_len[i] != 0); i++)
+        {
+            if (g64->blank_len[i] == track_len)
+            {
+                g64->track_offset[entry] = g64->blank_offset[i];
+                return (1);
+            }
+        }
+
+        blank = malloc(track_len);
+        if (blank == NULL) return (0);
+        memset(blank, 0x55, track_len);
+        blank[0] = 0xff;
+        i = write_g64_track(g64, halftrack, blank, track_len, speed);
+        free(blank);
+
+        for (entry = 0; entry < 4; entry++)
+        {
+            if (g64->blank_len[entry] == 0)
+            {
+                g64->blank_len[entry] = track_len;
+                g64->blank_offset[entry] = g64->track_offset[halftrack - 2];
+                break;
+            }
+        }
+        return (i);
+    }
+
+    fseek(g64->fp, g64->pos, SEEK_SET);
+    length[0] = track_len % 256;
+    length[1] = track_len / 256;
+    if ((fwrite((char *) length, 2, 1, g64->fp) != 1)
+        || (fwrite((char *) gcr_track, track_len, 1, g64->fp) != 1))
+    {
+        fprintf(stderr, "Cannot write track data.\n");
+        return (0);
+    }
+
+    g64->track_offset[entry] = g64->pos;
+    g64->pos += 2 + track_len;
+    if (track_len > g64->max_len) g64->max_len = track_len;
+    return (1);
+}
+
+
+/* write header and tables of a G64 image and close it
+   Returns 1 on success, 0 on failure. */
+int close_g64(struct g64_writer *g64)
+{
+    BYTE header[G64_HEADER_SIZE];
+    int ok;
+
+    strcpy((char *) header, "GCR-1541");
+    header[8] = 0;                    /* G64 version */
+    header[9] = G64_HALFTRACKS;       /* Number of Halftracks */
+    header[10] = g64->max_len % 256;  /* Size of longest stored track */
+    header[11] = g64->max_len / 256;
+
+    ok = 1;
+    fseek(g64->fp, 0, SEEK_SET);
+    if (fwrite((char *) header, sizeof(header), 1, g64->fp) != 1)
+    {
+        fprintf(stderr, "Cannot write G64 header.\n");
+        ok = 0;
+    }
+    else if (write_dword(g64->fp, g64->track_offset,
+                         sizeof(g64->track_offset)) < 0)
+    {
+        fprintf(stderr, "Cannot write track header.\n");
+        ok = 0;
+    }
+    else if (write_dword(g64->fp, g64->speed, sizeof(g64->speed)) < 0)
+    {
+        fprintf(stderr, "Cannot write speed header.\n");
+        ok = 0;
+    }
+
+    if (fclose(g64->fp) != 0) ok = 0;
+    g64->fp = NULL;
+    return (ok);
+}
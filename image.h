@@ -0,0 +1,88 @@
+/* image.h - reading NIB, NBZ and G64 disk images, writing G64 images
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version, whole image is read with one fread()
+    V 0.11   G64 tracks are found by the offset table and read on demand
+    V 0.12   added compact G64 writer
+    V 0.13   added packed NIB images (NBZ)
+    V 0.14   added streaming NIB images, read from stdin or a pipe
+    V 0.15   added image_track_failed()
+*/
+
+#ifndef _IMAGE_
+#define _IMAGE_
+
+#include <stdio.h>
+#include "gcr.h"
+
+
+/* image types */
+#define IMAGE_NIB 1
+#define IMAGE_G64 2
+#define IMAGE_NBZ 3
+#define IMAGE_STREAM 4
+
+/* streaming NIB constants */
+#define STREAM_MAGIC "MNIB-1541-STR"    /* replaces "MNIB-1541-RAW" */
+#define STREAM_HEADER_SIZE 0x10
+
+/* G64 constants */
+#define G64_HEADER_SIZE 12
+#define G64_TRACK_SLOT 7930     /* size of a track slot written by n2g */
+#define G64_HALFTRACKS (MAX_TRACKS_1541 * 2)
+
+
+/* a disk image, see open_image() */
+struct disk_image
+{
+    int type;           /* IMAGE_NIB, IMAGE_NBZ, IMAGE_STREAM or IMAGE_G64 */
+    BYTE *data;         /* NIB, NBZ: contents of the image file */
+    long size;          /* size of the image file */
+
+    /* G64: the tables are read on open, the tracks when needed
+       NBZ: tracks are unpacked when needed, by halftrack like G64
+       STREAM: tracks and densities (in speed) are kept as they arrive */
+    FILE *fp;
+    int halftracks;     /* number of halftrack entries in the tables */
+    DWORD track_offset[G64_HALFTRACKS];
+    DWORD speed[G64_HALFTRACKS];
+    BYTE *track[G64_HALFTRACKS];
+    int track_len[G64_HALFTRACKS];
+    int last_halftrack; /* STREAM: last halftrack read */
+    int stream_end;     /* STREAM: end of stream reached */
+};
+
+
+/* a G64 image being written, see create_g64() */
+struct g64_writer
+{
+    FILE *fp;
+    long pos;           /* file offset for the next track */
+    int max_len;        /* longest track written */
+    DWORD track_offset[G64_HALFTRACKS];
+    DWORD speed[G64_HALFTRACKS];
+    int blank_len[4];   /* blank tracks written so far, one per length */
+    DWORD blank_offset[4];
+};
+
+
+int open_image(struct disk_image *image, char *name);
+
+BYTE *image_track(struct disk_image *image, int halftrack, int *track_len);
+
+int image_density(struct disk_image *image, int halftrack);
+
+int image_track_failed(struct disk_image *image, int halftrack);
+
+void close_image(struct disk_image *image);
+
+int create_g64(struct g64_writer *g64, char *name);
+
+int write_g64_track(struct g64_writer *g64, int halftrack,
+                    BYTE *gcr_track, int track_len, int speed);
+
+int close_g64(struct g64_writer *g64);
+
+
+#endif
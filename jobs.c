@@ -0,0 +1,152 @@
+/* jobs.c - runs independent jobs, on all processors under Linux
+
+    (C) 2026 mnib contributors
+
+    run_jobs() calls a job function once for each index.  Under Linux
+    the jobs are spread over one thread per processor, the calling
+    thread being one of them.  Each thread takes the next job from a
+    shared counter, so the jobs are started in order.  Jobs started by
+    a job run one after the other in its thread, only the outermost
+    run_jobs() starts threads.  Without threads (DJGPP) all jobs run
+    one after the other.
+
+    Jobs must not share state, except between lock_jobs() and
+    unlock_jobs().
+
+    V 0.10   first version
+*/
+
+#include "jobs.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+int job_threads = 0;
+
+
+#ifdef __linux__
+
+#define MAX_JOB_THREADS 64
+
+struct job_queue
+{
+    job_function job;
+    void *context;
+    int jobs;
+    int next;                   /* next job to start */
+    pthread_mutex_t lock;
+};
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
+static int running = 0;         /* threads of run_jobs() are working */
+
+
+static void *job_thread(void *arg)
+{
+    struct job_queue *queue;
+    int index;
+
+    queue = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->lock);
+        index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->jobs) break;
+        queue->job(queue->context, index);
+    }
+    return (NULL);
+}
+
+
+/* threads for a number of jobs, one per processor by default */
+static int count_threads(int jobs)
+{
+    long processors;
+    int threads;
+
+    threads = job_threads;
+    if (threads <= 0)
+    {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (processors > 0) ? processors : 1;
+    }
+    if (threads > MAX_JOB_THREADS) threads = MAX_JOB_THREADS;
+    if (threads > jobs) threads = jobs;
+    return (threads);
+}
+
+
+void run_jobs(int jobs, job_function job, void *context)
+{
+    struct job_queue queue;
+    pthread_t thread[MAX_JOB_THREADS];
+    int threads, started;
+    int i;
+
+    pthread_mutex_lock(&running_lock);
+    threads = running ? 1 : count_threads(jobs);
+    if (threads > 1) running = 1;
+    pthread_mutex_unlock(&running_lock);
+
+    if (threads <= 1)
+    {
+        for (i = 0; i < jobs; i++) job(context, i);
+        return;
+    }
+
+    queue.job = job;
+    queue.context = context;
+    queue.jobs = jobs;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    /* if no thread can be started, the calling thread does all jobs */
+    for (started = 0; started < threads - 1; started++)
+        if (pthread_create(&thread[started], NULL, job_thread, &queue) != 0)
+            break;
+    job_thread(&queue);
+    for (i = 0; i < started; i++) pthread_join(thread[i], NULL);
+    pthread_mutex_destroy(&queue.lock);
+
+    pthread_mutex_lock(&running_lock);
+    running = 0;
+    pthread_mutex_unlock(&running_lock);
+}
+
+
+void lock_jobs(void)
+{
+    pthread_mutex_lock(&shared_lock);
+}
+
+
+void unlock_jobs(void)
+{
+    pthread_mutex_unlock(&shared_lock);
+}
+
+#else
+
+void run_jobs(int jobs, job_function job, void *context)
+{
+    int i;
+
+    for (i = 0; i < jobs; i++) job(context, i);
+}
+
+
+void lock_jobs(void)
+{
+}
+
+
+void unlock_jobs(void)
+{
+}
+
+#endif
@@ -0,0 +1,27 @@
+/* jobs.h - runs independent jobs, on all processors under Linux
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version
+*/
+
+#ifndef _JOBS_
+#define _JOBS_
+
+
+/* one job of run_jobs(), index counts from 0 */
+typedef void (*job_function)(void *context, int index);
+
+
+/* number of threads, 0: one per processor (default), 1: no threads */
+extern int job_threads;
+
+
+void run_jobs(int jobs, job_function job, void *context);
+
+void lock_jobs(void);
+
+void unlock_jobs(void);
+
+
+#endif
@@ -7,19 +7,38 @@
  *  Copyright 1999 Michael Klein <michael.klein@puffin.lb.shuttle.de>
  *
  *	Modified for DOS use by Markus Brenner <markus@brenner.de>
+ *
+ *	Linux: the ports are accessed through ppdev (/dev/parportN), the
+ *	user needs read and write access to it.  The nibble transfer does
+ *	not wait for the PC, so mnib asks for realtime scheduling in place
+ *	of disabling interrupts, it needs root (or CAP_SYS_NICE) for that.
+ *
+ *	-tlpt:emu:image runs the XE1541 code against the port emulator of
+ *	lptemu.c, without a printer port.
 */
 
 /*
 #define DEBUG
 */
 
-#include <pc.h>                         /* PC specific includes (outb, inb) */
 #include <stdio.h>                      /* printk substituted by printf */
+#include <string.h>
 #include <unistd.h>                     /* usleep() function */
-#include <dos.h>                        /* delay() */
 #include <errno.h>                      /* EINVAL */
 #include <time.h>                       /* PC specific includes (outb, inb) */
+#if defined(__DJGPP__)
+#include <pc.h>                         /* PC specific includes (outb, inb) */
+#include <dos.h>                        /* delay() */
+#else
+#include <fcntl.h>
+#include <sched.h>                      /* realtime scheduling */
+#include <sys/ioctl.h>
+#include <sys/time.h>                   /* gettimeofday() */
+#include <linux/parport.h>
+#include <linux/ppdev.h>
+#endif
 
+#include "cbm.h"
 #include "kernel.h"
 
 /* unsigned int serport        = 0x378; */      /* 'serial' LPT port address */
@@ -30,11 +49,6 @@ unsigned int serport;   /* 'serial' LPT port address */
 unsigned int parport;   /* 'parallel' LPT port address */
 
 
-/* symbolic names */
-#define IEC_DATA   1
-#define IEC_CLOCK  2
-#define IEC_ATN    4
-
 /* lpt output lines */
 #define ATN_OUT    0x01
 #define CLK_OUT    0x02
@@ -57,12 +71,15 @@ static unsigned char *serportval;           /* current value in output register
 static unsigned char *parportval;           /* current value in output register */
 static unsigned char portval[4];           /* current value in output register */
 
-#define SET(line)       (outportb(serport+2,(*serportval|=line)^OUTMASK))
-#define RELEASE(line)   (outportb(serport+2,(*serportval&=~(line))^OUTMASK))
-#define GET(line)       (((inportb(serport+1)^INMASK)&line)==0?1:0)
+static struct lpt_io *io;                  /* port access, see lpt_init() */
+static char *io_arg;
 
-#define PARREAD()       (outportb(parport+2,(*parportval|=0x20)^OUTMASK))
-#define PARWRITE()      (outportb(parport+2,(*parportval&=0xdf)^OUTMASK))
+#define SET(line)       (io->control(serport,(*serportval|=line)^OUTMASK))
+#define RELEASE(line)   (io->control(serport,(*serportval&=~(line))^OUTMASK))
+#define GET(line)       (((io->status(serport)^INMASK)&line)==0?1:0)
+
+#define PARREAD()       (io->control(parport,(*parportval|=0x20)^OUTMASK))
+#define PARWRITE()      (io->control(parport,(*parportval&=0xdf)^OUTMASK))
 
 #ifdef DEBUG
   #define DPRINTK(fmt,args...)     printf(fmt, ## args)
@@ -72,6 +89,49 @@ static unsigned char portval[4];           /* current value in output register *
   #define SHOW(str)
 #endif
 
+#if !defined(__DJGPP__)
+/* DJGPP functions for Linux */
+typedef long long uclock_t;
+#define UCLOCKS_PER_SEC 1000000
+
+static uclock_t uclock(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((uclock_t) tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+static void delay(int msec)
+{
+    usleep(msec * 1000L);
+}
+
+/* no interrupts to lock, keep other processes off the CPU instead */
+static void disable(void)
+{
+    struct sched_param param;
+
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    sched_setscheduler(0, SCHED_FIFO, &param);
+}
+
+static void enable(void)
+{
+    struct sched_param param;
+
+    param.sched_priority = 0;
+    sched_setscheduler(0, SCHED_OTHER, &param);
+}
+#endif
+
+/* wall clock in milliseconds, clock() does not count the time the
+   process waits for the drive on Linux */
+unsigned long cbm_msec(void)
+{
+    return ((unsigned long) (uclock() * 1000 / UCLOCKS_PER_SEC));
+}
+
 static int eoi;
 static int irq_count;
 static uclock_t t_timeout;
@@ -201,13 +261,13 @@ static void release_all(void)
         RELEASE(ATN_OUT | DATA_OUT);
 }
 
-int cbm_read(int f, char *buf, int count)
+static int lpt_read(int f, char *buf, int count)
 {
         int received = 0;
         int i, b, bit;
         int ok = 0;
 
-        DPRINTK("cbm_read: %d bytes\n", count);
+        DPRINTK("lpt_read: %d bytes\n", count);
 
         if(eoi) {
                 return 0;
@@ -345,12 +405,12 @@ static int cbm_raw_write(const char *buf, size_t cnt, int atn, int talk)
         return (rv < 0) ? rv : sent;
 }
 
-int cbm_write(int f, char *buf, int cnt)
+static int lpt_write(int f, char *buf, int cnt)
 {
         return cbm_raw_write(buf, cnt, 0, 0);
 }
 
-int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
+static int lpt_ioctl(int f, unsigned int cmd, unsigned long arg)
 {
         unsigned char buf[2], c, talk;
         int rv = 0;
@@ -386,7 +446,7 @@ int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
                         return rv > 0 ? 0 : rv;
 
                 case CBMCTRL_IEC_POLL:
-                        c = inportb(serport+1);
+                        c = io->status(serport);
                         if((c & DATA_IN) == 0) rv |= IEC_DATA;
                         if((c & CLK_IN ) == 0) rv |= IEC_CLOCK;
                         if((c & ATN_IN ) == 0) rv |= IEC_ATN;
@@ -426,12 +486,12 @@ int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
 
                 case CBMCTRL_PP_READ:
                         PARREAD();
-                        rv = inportb(parport);
+                        rv = io->data(parport);
                         PARWRITE();
                         return rv;
 
                 case CBMCTRL_PP_WRITE:
-                        outportb(parport, arg);
+                        io->write_data(parport, arg);
                         return 0;
 
                 case CBMCTRL_PAR_READ:
@@ -440,7 +500,7 @@ int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
 //                        msleep(10); /* 200? */
                         for (j=0; j < 20; j++) GET(DATA_IN);
                         while(GET(DATA_IN));
-                        rv = inportb(parport);
+                        rv = io->data(parport);
                         for (j=0; j < 5; j++) GET(DATA_IN); // extra
                         RELEASE(ATN_OUT);
 //                        msleep(10);
@@ -456,7 +516,7 @@ int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
                         for (j=0; j < 20; j++) GET(DATA_IN);
                         while(GET(DATA_IN));
                         PARWRITE();
-                        outportb(parport, arg);
+                        io->write_data(parport, arg);
                         for (j=0; j < 5; j++) GET(DATA_IN);
 //                        msleep(10);
                         RELEASE(ATN_OUT);
@@ -472,7 +532,7 @@ int cbm_ioctl(int f, unsigned int cmd, unsigned long arg)
         return -EINVAL;
 }
 
-int cbm_nib_read1(int f)
+static int lpt_nib_read1(int f)
 {
     int to;
     int j;
@@ -483,10 +543,10 @@ int cbm_nib_read1(int f)
     while (GET(DATA_IN))
         if (to++ > 1000000) return (-1);
 //        if(mtimeout()) return (-1);
-    return inportb(parport);
+    return io->data(parport);
 }
 
-int cbm_nib_read2(int f)
+static int lpt_nib_read2(int f)
 {
     int to;
     int j;
@@ -500,7 +560,29 @@ int cbm_nib_read2(int f)
 /*
     inportb(parport);
 */
-    return inportb(parport);
+    return io->data(parport);
+}
+
+/*
+ *  read a whole track, the drive toggles DATA for each byte and
+ *  does not wait.  DATA_OUT stays released, so only DATA_IN is polled
+ *  per byte.  Returns the number of bytes read before a timeout.
+ */
+static int lpt_nib_read_track(int f, __u_char *buf, int count)
+{
+    int to;
+    int i, j;
+
+    RELEASE(DATA_OUT);
+    for (i = 0; i < count; i++)
+    {
+        for (j=0; j < 2; j++) GET(DATA_IN);
+        to = 0;
+        while (GET(DATA_IN) == !(i & 1))
+            if (to++ > 1000000) return (i);
+        buf[i] = io->data(parport);
+    }
+    return (count);
 }
 
 /*
@@ -553,13 +635,15 @@ int set_par_port(int port)
     else return (0);
 }
 
-int detect_ports(int reset)
+#if defined(__DJGPP__)
+/*
+ *  DOS: ports from the BIOS table, direct port I/O
+ */
+static int dos_open(char *arg, unsigned int *lpt)
 {
-    int i;
+    int i, num;
     unsigned char byte[8];
     unsigned int port;
-    int found;
-    int goodport;
 
     unsigned char ecr;
     char *ecpm[8] = 
@@ -575,12 +659,11 @@ int detect_ports(int reset)
     };
 
     _dosmemgetb(0x411, 1, byte);
-    lpt_num = (byte[0] & 0xc0) >> 6;
-    printf("Number of LPT ports found: %d\n", lpt_num);
+    num = (byte[0] & 0xc0) >> 6;
 
-    _dosmemgetb(0x408, lpt_num * 2, byte);
+    _dosmemgetb(0x408, num * 2, byte);
 
-    for (i = 0; i < lpt_num; i++)
+    for (i = 0; i < num; i++)
     {
         port = byte[2*i] + byte[2*i+1]*0x100;
         lpt[i] = port;
@@ -588,7 +671,7 @@ int detect_ports(int reset)
 
 
     /* on ECP ports force BYTE mode */
-    for (i = 0; i < lpt_num; i++)
+    for (i = 0; i < num; i++)
     {
         port = lpt[i];
         ecr = inportb(port+0x402);
@@ -599,6 +682,150 @@ int detect_ports(int reset)
         printf("Forcing Byte Mode\n");
         outportb(port+0x402, (ecr & 0x1f) | 0x20);
     }
+    return (num);
+}
+
+static unsigned char dos_status(unsigned int port)
+{
+    return inportb(port+1);
+}
+
+static unsigned char dos_data(unsigned int port)
+{
+    return inportb(port);
+}
+
+static void dos_write_data(unsigned int port, unsigned char value)
+{
+    outportb(port, value);
+}
+
+static void dos_control(unsigned int port, unsigned char value)
+{
+    outportb(port+2, value);
+}
+
+static struct lpt_io dos_io =
+{
+    "dos",
+    dos_open,
+    dos_status,
+    dos_data,
+    dos_write_data,
+    dos_control
+};
+
+#define DEFAULT_IO dos_io
+
+#else
+/*
+ *  Linux: ppdev, port n is /dev/parportn or the device given as
+ *  -tlpt:device.  The kernel sets ECP ports to byte (PS/2) mode.
+ *  Each register access is a system call, so control values that did
+ *  not change are not written again.
+ */
+static int ppdev_fd[4];
+static int ppdev_control[4];            /* last value written, -1: none */
+
+static int ppdev_claim(char *device, unsigned int *lpt, int num)
+{
+    int fd;
+
+    fd = open(device, O_RDWR);
+    if (fd < 0) return (num);
+    if ((ioctl(fd, PPEXCL) != 0) || (ioctl(fd, PPCLAIM) != 0))
+    {
+        fprintf(stderr, "Cannot claim %s.\n", device);
+        close(fd);
+        return (num);
+    }
+    printf("Using %s as port %d\n", device, num);
+    ppdev_fd[num] = fd;
+    ppdev_control[num] = -1;
+    lpt[num] = num;
+    return (num + 1);
+}
+
+static int ppdev_open(char *arg, unsigned int *lpt)
+{
+    char device[32];
+    int i, num;
+
+    if (*arg != '\0') return (ppdev_claim(arg, lpt, 0));
+
+    for (i = num = 0; i < 4; i++)
+    {
+        sprintf(device, "/dev/parport%d", i);
+        num = ppdev_claim(device, lpt, num);
+    }
+    return (num);
+}
+
+static unsigned char ppdev_status(unsigned int port)
+{
+    unsigned char value;
+
+    ioctl(ppdev_fd[port], PPRSTATUS, &value);
+    return (value);
+}
+
+static unsigned char ppdev_data(unsigned int port)
+{
+    unsigned char value;
+
+    ioctl(ppdev_fd[port], PPRDATA, &value);
+    return (value);
+}
+
+static void ppdev_write_data(unsigned int port, unsigned char value)
+{
+    ioctl(ppdev_fd[port], PPWDATA, &value);
+}
+
+/* PPWCONTROL only sets the four output lines, the data direction
+   bit $20 has its own ioctl */
+static void ppdev_control_write(unsigned int port, unsigned char value)
+{
+    int changed, dir;
+    unsigned char lines;
+
+    changed = (ppdev_control[port] < 0) ? 0xff : value ^ ppdev_control[port];
+    if (changed & 0x0f)
+    {
+        lines = value & 0x0f;
+        ioctl(ppdev_fd[port], PPWCONTROL, &lines);
+    }
+    if (changed & 0x20)
+    {
+        dir = (value & 0x20) ? 1 : 0;
+        ioctl(ppdev_fd[port], PPDATADIR, &dir);
+    }
+    ppdev_control[port] = value;
+}
+
+static struct lpt_io ppdev_io =
+{
+    "ppdev",
+    ppdev_open,
+    ppdev_status,
+    ppdev_data,
+    ppdev_write_data,
+    ppdev_control_write
+};
+
+#define DEFAULT_IO ppdev_io
+
+#endif
+
+
+int detect_ports(int reset)
+{
+    int i;
+    int found;
+    int goodport;
+
+    lpt_num = io->open(io_arg, lpt);
+    printf("Number of LPT ports found: %d\n", lpt_num);
 
     if (reset)
     {
@@ -647,3 +874,54 @@ int detect_ports(int reset)
         return (0);
     }
 }
+
+
+/*
+ *  arg: empty for the printer ports of the PC, emu:image for the port
+ *  emulator, on Linux also the ppdev device to use
+ */
+static int lpt_init(int reset, char *arg)
+{
+    if (strncmp(arg, "emu:", 4) == 0)
+    {
+        io = &lptemu_io;
+        io_arg = arg + 4;
+    }
+    else
+    {
+        io = &DEFAULT_IO;
+        io_arg = arg;
+    }
+    return detect_ports(reset);
+}
+
+static void lpt_delay(int msec)
+{
+    delay(msec);
+}
+
+static void lpt_disable(void)
+{
+    disable();
+}
+
+static void lpt_enable(void)
+{
+    enable();
+}
+
+struct cbm_transport lpt_transport =
+{
+    "lpt",
+    lpt_init,
+    set_par_port,
+    lpt_ioctl,
+    lpt_read,
+    lpt_write,
+    lpt_nib_read1,
+    lpt_nib_read2,
+    lpt_nib_read_track,
+    lpt_delay,
+    lpt_disable,
+    lpt_enable
+};
@@ -27,4 +27,25 @@
 #define CBMCTRL_PAR_READ    15
 #define CBMCTRL_PAR_WRITE   16
 
+
+/*
+ *  printer port registers, see detect_ports()
+ *
+ *  open() finds the ports and puts their numbers into lpt[], it returns
+ *  the number of ports.  The registers are data (base), status (base+1)
+ *  and control (base+2), control bit $20 switches the data lines to
+ *  input.
+ */
+struct lpt_io
+{
+    char *name;
+    int (*open)(char *arg, unsigned int *lpt);
+    unsigned char (*status)(unsigned int port);
+    unsigned char (*data)(unsigned int port);
+    void (*write_data)(unsigned int port, unsigned char value);
+    void (*control)(unsigned int port, unsigned char value);
+};
+
+extern struct lpt_io lptemu_io;         /* lptemu.c: emulated drive */
+
 #endif
@@ -0,0 +1,508 @@
+/* lptemu.c - printer port emulator with a drive on the XE1541 cable
+
+    (C) 2026 mnib contributors
+
+    Stand-in for the printer port registers, used by kernel.c with
+    -tlpt:emu:image.  The emulated drive answers the IEC bus like the
+    1541 ROM and the parallel handshake like bn_flop, commands and
+    tracks come from the simulated drive of simdrive.c.  This runs the
+    XE1541 code of kernel.c without a printer port or drive:
+
+        mnib -tlpt:emu:image.nib output.nib
+
+    Time on the bus is counted in reads of the status register, the
+    drive takes one step per read and reacts to each control write at
+    once.  kernel.c looks for an EOI acknowledge only after 150 reads
+    and polls 40 times for the start of a byte, so the drive holds the
+    acknowledge longer and starts its bytes sooner.
+
+    ATN with CLK released is the parallel handshake of bn_flop, with
+    CLK held it is a serial command.  A parallel byte read right before
+    the end of a read command starts the track transfer, the drive then
+    toggles DATA for each byte the host takes from the data register.
+
+    V 0.10   first version
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbm.h"
+#include "kernel.h"
+#include "gcr.h"
+
+
+/* lpt lines as in kernel.c */
+#define ATN_OUT    0x01
+#define CLK_OUT    0x02
+#define DATA_OUT   0x08
+#define RESET_OUT  0x04
+#define OUTMASK    0x04
+
+#define ATN_IN     0x10
+#define CLK_IN     0x20
+#define DATA_IN    0x80
+#define RESET_IN   0x40
+
+#define DIR_IN     0x20             /* control: data lines are input */
+
+/* bus time in status reads */
+#define EOI_TICKS      40           /* no CLK from the talker: EOI */
+#define EOI_ACK_TICKS  150          /* length of the EOI acknowledge */
+#define TALK_TICKS     3            /* talker turnaround */
+#define BIT_TICKS      3            /* each half of a bit */
+#define SETTLE_TICKS   24           /* handshake end to first track byte */
+
+#define FD 1
+
+#define LISTEN     1
+#define TALK       2
+
+/* what the drive does */
+#define M_IDLE     0
+#define M_ATN      1                /* receiving serial commands */
+#define M_LISTEN   2                /* receiving serial data */
+#define M_TALK     3                /* sending serial data */
+#define M_PAR      4                /* parallel handshake of bn_flop */
+#define M_TRACK    5                /* track transfer of bn_flop */
+
+/* steps of receiving a serial byte */
+#define RX_WAIT    0                /* DATA held, wait for talker */
+#define RX_READY   1                /* DATA released */
+#define RX_EOI     2                /* EOI acknowledge */
+#define RX_LOW     3                /* bit: wait for CLK released */
+#define RX_HIGH    4                /* bit: wait for CLK held */
+
+/* steps of sending a serial byte */
+#define TX_TURN    0                /* wait for the host to release CLK */
+#define TX_START   1                /* CLK held after turnaround */
+#define TX_READY   2                /* wait for the listener */
+#define TX_EOI     3                /* wait for the EOI acknowledge */
+#define TX_EOI_END 4
+#define TX_SETUP   5                /* bit on DATA, CLK held */
+#define TX_VALID   6                /* CLK released */
+#define TX_ACK     7                /* wait for the frame acknowledge */
+#define TX_DONE    8
+
+/* steps of the parallel handshake */
+#define PAR_IDLE   0
+#define PAR_CYCLE  1                /* ATN held */
+#define PAR_SETTLE 2                /* track transfer starts */
+#define PAR_RUN    3
+
+
+static int host_lines;              /* lines held by the host */
+static int host_dir_in;
+static BYTE host_par;               /* data register written by the host */
+static int drive_clk, drive_data;   /* lines held by the drive */
+static BYTE drive_par;              /* parallel byte from the drive */
+
+static int mode = M_IDLE;
+static int step;
+static int ticks;                   /* status reads in this step */
+static int atn_new;                 /* ATN held, not answered yet */
+
+static int bits, byte, eoi;         /* serial byte */
+static int addressed;               /* LISTEN or TALK to drive 8 */
+static int listening, talking;
+static char talk_data[64];
+static int talk_len, talk_pos;
+
+static int par_read, par_written;   /* in this parallel handshake */
+static int track_byte;
+
+
+#define BUS_ATN    (host_lines & ATN_OUT)
+#define BUS_CLK    ((host_lines & CLK_OUT) || drive_clk)
+#define BUS_DATA   ((host_lines & DATA_OUT) || drive_data)
+
+
+static void set_step(int new_step)
+{
+    step = new_step;
+    ticks = 0;
+}
+
+
+/* a byte received under ATN: LISTEN, TALK and secondary address */
+static void atn_byte(int b)
+{
+    if (b == 0x3f)
+    {
+        if (listening) sim_transport.ioctl(FD, CBMCTRL_UNLISTEN, 0);
+        listening = addressed = 0;
+    }
+    else if (b == 0x5f)
+    {
+        if (talking) sim_transport.ioctl(FD, CBMCTRL_UNTALK, 0);
+        talking = addressed = 0;
+    }
+    else if ((b & 0xe0) == 0x20)
+        addressed = ((b & 0x1f) == 8) ? LISTEN : 0;
+    else if ((b & 0xe0) == 0x40)
+        addressed = ((b & 0x1f) == 8) ? TALK : 0;
+    else if (((b & 0xf0) == 0x60) || ((b & 0xf0) == 0xf0))
+    {
+        /* data channel or open */
+        if (addressed == 0) return;
+        if (addressed == LISTEN)
+        {
+            sim_transport.ioctl(FD, CBMCTRL_LISTEN, (8 << 8) | (b & 0x0f));
+            listening = 1;
+        }
+        else
+        {
+            sim_transport.ioctl(FD, CBMCTRL_TALK, (8 << 8) | (b & 0x0f));
+            talking = 1;
+            talk_len = sim_transport.read(FD, talk_data, sizeof(talk_data));
+            if (talk_len <= 0)
+            {
+                talk_data[0] = '\r';
+                talk_len = 1;
+            }
+            talk_pos = 0;
+        }
+    }
+}
+
+
+static void got_byte(int b)
+{
+    char c;
+
+    if (mode == M_ATN)
+        atn_byte(b);
+    else
+    {
+        c = b;
+        sim_transport.write(FD, &c, 1);
+    }
+}
+
+
+/* the drive as listener, returns 1 if anything changed */
+static int listener(void)
+{
+    switch (step)
+    {
+        case RX_WAIT:
+            if (BUS_CLK) return (0);
+            drive_data = 0;
+            set_step(RX_READY);
+            return (1);
+
+        case RX_READY:
+            if (BUS_CLK)
+            {
+                bits = byte = 0;
+                set_step(RX_LOW);
+                return (1);
+            }
+            if (eoi || (ticks < EOI_TICKS)) return (0);
+            eoi = 1;
+            drive_data = 1;
+            set_step(RX_EOI);
+            return (1);
+
+        case RX_EOI:
+            if (ticks < EOI_ACK_TICKS) return (0);
+            drive_data = 0;
+            set_step(RX_READY);
+            return (1);
+
+        case RX_LOW:
+            if (BUS_CLK) return (0);
+            if (!BUS_DATA) byte |= 1 << bits;
+            set_step(RX_HIGH);
+            return (1);
+
+        case RX_HIGH:
+            if (!BUS_CLK) return (0);
+            if (++bits < 8)
+            {
+                set_step(RX_LOW);
+                return (1);
+            }
+            drive_data = 1;             /* frame acknowledge */
+            set_step(RX_WAIT);
+            got_byte(byte);
+            eoi = 0;
+            return (1);
+    }
+    return (0);
+}
+
+
+static void send_bit(void)
+{
+    drive_data = ((talk_data[talk_pos] >> bits) & 1) ? 0 : 1;
+    set_step(TX_SETUP);
+}
+
+
+/* the drive as talker, returns 1 if anything changed */
+static int talker(void)
+{
+    switch (step)
+    {
+        case TX_TURN:
+            if (host_lines & CLK_OUT) return (0);
+            drive_clk = 1;
+            set_step(TX_START);
+            return (1);
+
+        case TX_START:
+            if (ticks < TALK_TICKS) return (0);
+            drive_clk = 0;
+            set_step(TX_READY);
+            return (1);
+
+        case TX_READY:
+            if (BUS_DATA) return (0);
+            bits = 0;
+            if (talk_pos == talk_len - 1)
+            {
+                set_step(TX_EOI);
+                return (1);
+            }
+            drive_clk = 1;
+            send_bit();
+            return (1);
+
+        case TX_EOI:
+            if (!BUS_DATA) return (0);
+            set_step(TX_EOI_END);
+            return (1);
+
+        case TX_EOI_END:
+            if (BUS_DATA) return (0);
+            drive_clk = 1;
+            send_bit();
+            return (1);
+
+        case TX_SETUP:
+            if (ticks < BIT_TICKS) return (0);
+            drive_clk = 0;
+            set_step(TX_VALID);
+            return (1);
+
+        case TX_VALID:
+            if (ticks < BIT_TICKS) return (0);
+            drive_clk = 1;
+            if (++bits < 8)
+            {
+                send_bit();
+                return (1);
+            }
+            drive_data = 0;
+            set_step(TX_ACK);
+            return (1);
+
+        case TX_ACK:
+            if (!BUS_DATA) return (0);
+            drive_clk = 0;
+            set_step((++talk_pos < talk_len) ? TX_READY : TX_DONE);
+            return (1);
+    }
+    return (0);
+}
+
+
+/* end of a parallel handshake, a read may start a track transfer */
+static void end_par_cycle(void)
+{
+    if (par_written)
+        sim_transport.ioctl(FD, CBMCTRL_PAR_WRITE, host_par);
+    drive_data = 1;
+    set_step(PAR_IDLE);
+
+    if (par_written) return;
+    track_byte = sim_transport.nib_read1(FD);
+    if (track_byte < 0) return;
+    mode = M_TRACK;
+    set_step(PAR_SETTLE);
+}
+
+
+/* ATN held by the host: serial command or parallel handshake */
+static void answer_atn(void)
+{
+    atn_new = 0;
+    drive_clk = 0;
+    if (host_lines & CLK_OUT)
+    {
+        mode = M_ATN;
+        drive_data = 1;
+        addressed = eoi = 0;
+        set_step(RX_WAIT);
+    }
+    else
+    {
+        mode = M_PAR;
+        drive_data = 0;
+        par_read = par_written = 0;
+        set_step(PAR_CYCLE);
+    }
+}
+
+
+/* run the drive until nothing changes */
+static void update(void)
+{
+    int changed;
+
+    do
+    {
+        changed = 0;
+        switch (mode)
+        {
+            case M_ATN:
+                if (!BUS_ATN)
+                {
+                    if (talking)
+                    {
+                        mode = M_TALK;
+                        drive_data = 0;
+                        set_step(TX_TURN);
+                    }
+                    else if (listening)
+                        mode = M_LISTEN;
+                    else
+                    {
+                        mode = M_IDLE;
+                        drive_data = 0;
+                    }
+                    changed = 1;
+                }
+                else
+                    changed = listener();
+                break;
+
+            case M_LISTEN:
+                changed = listener();
+                break;
+
+            case M_TALK:
+                changed = talker();
+                break;
+
+            case M_PAR:
+                if ((step == PAR_CYCLE) && !BUS_ATN)
+                {
+                    end_par_cycle();
+                    changed = 1;
+                }
+                break;
+
+            case M_TRACK:
+                if ((step == PAR_SETTLE) && (ticks >= SETTLE_TICKS))
+                {
+                    drive_data = 0;
+                    drive_par = track_byte;
+                    set_step(PAR_RUN);
+                    changed = 1;
+                }
+                break;
+        }
+    } while (changed);
+}
+
+
+static int emu_open(char *arg, unsigned int *lpt)
+{
+    if (!sim_transport.init(0, arg)) return (0);
+
+    host_lines = host_dir_in = 0;
+    drive_clk = drive_data = 0;
+    mode = M_IDLE;
+    atn_new = listening = talking = 0;
+    lpt[0] = 0;
+    return (1);
+}
+
+
+static unsigned char emu_status(unsigned int port)
+{
+    BYTE status;
+
+    ticks++;
+    if (atn_new) answer_atn();
+    update();
+
+    /* DATA_IN reads inverted, see INMASK in kernel.c */
+    status = 0;
+    if (BUS_DATA) status |= DATA_IN;
+    if (!BUS_CLK) status |= CLK_IN;
+    if (!BUS_ATN) status |= ATN_IN;
+    if (!(host_lines & RESET_OUT)) status |= RESET_IN;
+    return (status);
+}
+
+
+static unsigned char emu_data(unsigned int port)
+{
+    BYTE value;
+
+    if (!host_dir_in) return (host_par);
+
+    if ((mode == M_TRACK) && (step == PAR_RUN))
+    {
+        /* the host took the byte, on to the next one */
+        value = drive_par;
+        track_byte = sim_transport.nib_read1(FD);
+        if (track_byte < 0)
+            mode = M_PAR;
+        else
+        {
+            drive_par = track_byte;
+            drive_data = !drive_data;
+        }
+        return (value);
+    }
+
+    if ((mode == M_PAR) && (step == PAR_CYCLE) && !par_read)
+    {
+        drive_par = sim_transport.ioctl(FD, CBMCTRL_PAR_READ, 0);
+        par_read = 1;
+    }
+    return (drive_par);
+}
+
+
+static void emu_write_data(unsigned int port, unsigned char value)
+{
+    host_par = value;
+    if ((mode == M_PAR) && (step == PAR_CYCLE)) par_written = 1;
+}
+
+
+static void emu_control(unsigned int port, unsigned char value)
+{
+    int lines;
+
+    lines = (value ^ OUTMASK) & (ATN_OUT | CLK_OUT | DATA_OUT | RESET_OUT);
+    host_dir_in = (value & DIR_IN) != 0;
+    if ((lines & ATN_OUT) && !(host_lines & ATN_OUT)) atn_new = 1;
+    if (!(lines & ATN_OUT)) atn_new = 0;
+    host_lines = lines;
+
+    if (host_lines & RESET_OUT)
+    {
+        mode = M_IDLE;
+        drive_clk = drive_data = 0;
+        atn_new = listening = talking = 0;
+        return;
+    }
+    if (!atn_new) update();
+}
+
+
+struct lpt_io lptemu_io =
+{
+    "emu",
+    emu_open,
+    emu_status,
+    emu_data,
+    emu_write_data,
+    emu_control
+};
@@ -0,0 +1,110 @@
+/* mkgcrtab - generates the GCR conversion tables of gcr.c
+
+    (C) 2026 mnib contributors
+
+    Writes gcr_tab.h with a 1024 entry table that decodes one byte from
+    a pair of GCR quintets (10 bits).  Invalid quintets decode to 0xff
+    like in convert_4bytes_from_GCR(), bit 8 is set additionally.
+    A second table with 256 entries encodes a byte into its GCR quintet
+    pair.
+
+    Usage: mkgcrtab gcr_tab.h
+
+    V 0.10   first version
+    V 0.11   added the encoding table
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VERSION 0.11
+
+
+/* Nibble-to-GCR conversion table, see gcr.c */
+static unsigned char GCR_conv_data[16] =
+{
+    0x0a, 0x0b, 0x12, 0x13,
+    0x0e, 0x0f, 0x16, 0x17,
+    0x09, 0x19, 0x1a, 0x1b,
+    0x0d, 0x1d, 0x1e, 0x15
+};
+
+/* GCR-to-Nibble conversion tables, see gcr.c */
+static unsigned char GCR_decode_high[32] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x80, 0x00, 0x10, 0xff, 0xc0, 0x40, 0x50,
+    0xff, 0xff, 0x20, 0x30, 0xff, 0xf0, 0x60, 0x70,
+    0xff, 0x90, 0xa0, 0xb0, 0xff, 0xd0, 0xe0, 0xff
+};
+
+static unsigned char GCR_decode_low[32] =
+{
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x08, 0x00, 0x01, 0xff, 0x0c, 0x04, 0x05,
+    0xff, 0xff, 0x02, 0x03, 0xff, 0x0f, 0x06, 0x07,
+    0xff, 0x09, 0x0a, 0x0b, 0xff, 0x0d, 0x0e, 0xff
+};
+
+
+int main(int argc, char **argv)
+{
+    FILE *fpout;
+    unsigned int value;
+    int high, low;
+    int pair;
+    int byte;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "mkgcrtab %.2f\nUsage: mkgcrtab gcr_tab.h\n",
+                VERSION);
+        exit (-1);
+    }
+
+    fpout = fopen(argv[1], "w");
+    if (fpout == NULL)
+    {
+        fprintf(stderr, "Cannot open output file %s.\n", argv[1]);
+        exit (-1);
+    }
+
+    fprintf(fpout,
+        "/* gcr_tab.h - generated by mkgcrtab, do not edit */\n\n"
+        "/* GCR quintet pair to byte conversion table, see mkgcrtab.c */\n"
+        "static unsigned short GCR_decode_pair[1024] =\n{\n");
+
+    for (pair = 0; pair < 1024; pair++)
+    {
+        high = GCR_decode_high[pair >> 5];
+        low = GCR_decode_low[pair & 0x1f];
+        value = high | low;
+        if ((high == 0xff) || (low == 0xff)) value |= 0x100;
+
+        if ((pair % 8) == 0) fprintf(fpout, "    ");
+        fprintf(fpout, "0x%03x", value);
+        if (pair != 1023) fprintf(fpout, ",");
+        fprintf(fpout, ((pair % 8) == 7) ? "\n" : " ");
+    }
+    fprintf(fpout, "};\n\n"
+        "/* byte to GCR quintet pair conversion table, see mkgcrtab.c */\n"
+        "static unsigned short GCR_encode_pair[256] =\n{\n");
+
+    for (byte = 0; byte < 256; byte++)
+    {
+        value = (GCR_conv_data[byte >> 4] << 5) | GCR_conv_data[byte & 0x0f];
+
+        if ((byte % 8) == 0) fprintf(fpout, "    ");
+        fprintf(fpout, "0x%03x", value);
+        if (byte != 255) fprintf(fpout, ",");
+        fprintf(fpout, ((byte % 8) == 7) ? "\n" : " ");
+    }
+    fprintf(fpout, "};\n");
+
+    if (fclose(fpout) != 0)
+    {
+        fprintf(stderr, "Cannot write output file %s.\n", argv[1]);
+        exit (-1);
+    }
+    return (0);
+}
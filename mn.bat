@@ -1 +1,4 @@
-gcc -o mnib.exe mnib.c cbm.c kernel.c gcr.c
+gcc -o mkgcrtab.exe mkgcrtab.c
+mkgcrtab gcr_tab.h
+gcc -o mnib.exe mnib.c cbm.c kernel.c lptemu.c simdrive.c cbmpipe.c image.c gcr.c nbz.c
+gcc -o cbmserve.exe cbmserve.c cbm.c kernel.c lptemu.c simdrive.c cbmpipe.c image.c gcr.c nbz.c
@@ -0,0 +1,12 @@
+gcc -o mkgcrtab mkgcrtab.c
+./mkgcrtab gcr_tab.h
+gcc -o gcrbench gcrbench.c gcr.c
+gcc -o mnib mnib.c cbm.c kernel.c lptemu.c simdrive.c cbmpipe.c image.c gcr.c nbz.c
+gcc -o cbmserve cbmserve.c cbm.c kernel.c lptemu.c simdrive.c cbmpipe.c image.c gcr.c nbz.c
+gcc -o n2d n2d.c gcr.c batch.c image.c nbz.c cache.c jobs.c -lpthread
+gcc -o g2d g2d.c gcr.c batch.c image.c nbz.c jobs.c -lpthread
+gcc -o n2g n2g.c extract.c gcr.c batch.c image.c nbz.c cache.c jobs.c -lpthread
+gcc -o nibz nibz.c gcr.c batch.c image.c nbz.c jobs.c -lpthread
+gcc -o nibstore nibstore.c extract.c gcr.c batch.c image.c nbz.c jobs.c -lpthread
+gcc -o nibdiff nibdiff.c extract.c gcr.c batch.c image.c nbz.c jobs.c -lpthread
+gcc -o nibmerge nibmerge.c extract.c gcr.c batch.c image.c nbz.c jobs.c -lpthread
@@ -1 +1,10 @@
-gcc -o n2d.exe n2d.c gcr.c
+gcc -o mkgcrtab.exe mkgcrtab.c
+mkgcrtab gcr_tab.h
+gcc -o gcrbench.exe gcrbench.c gcr.c
+gcc -o n2d.exe n2d.c gcr.c batch.c image.c nbz.c cache.c jobs.c
+gcc -o n2g.exe n2g.c extract.c gcr.c batch.c image.c nbz.c cache.c jobs.c
+gcc -o g2d.exe g2d.c gcr.c batch.c image.c nbz.c jobs.c
+gcc -o nibz.exe nibz.c gcr.c batch.c image.c nbz.c jobs.c
+gcc -o nibstore.exe nibstore.c extract.c gcr.c batch.c image.c nbz.c jobs.c
+gcc -o nibdiff.exe nibdiff.c extract.c gcr.c batch.c image.c nbz.c jobs.c
+gcc -o nibmerge.exe nibmerge.c extract.c gcr.c batch.c image.c nbz.c jobs.c
@@ -27,17 +27,33 @@
     V 0.32   bin-include bn_flop.prg  (bin2h bn_flop.prg floppy_code bn_flop.h)
     V 0.33   improved D64 mode
     V 0.33a  VCFe3 release (35 track flag)
+    V 0.34   added packed NIB output (NBZ)
+    V 0.35   added streaming NIB output to stdout or a pipe (-p)
+    V 0.36   drive access through a selectable transport (-t)
+    V 0.37   read a track in one transport call, Linux (ppdev) support
+    V 0.38   drive scans the next track while the host works on the last
+    V 0.39   D64 mode re-reads a track only until all sectors agree
+    V 0.40   problem tracks are read again after the disk, on a budget
+    V 0.41   streamed problem tracks are read again in place, tracks that
+             still fail are flagged in the header (NIB_TRACK_FAILED)
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if defined(__DJGPP__)
+#include <io.h>
 #include <sys/movedata.h>
+#endif
 #include "cbm.h"
 #include "gcr.h"
+#include "nbz.h"
 #include "bn_flop.h"        /* floppy code: unsigned char floppy_code[] */
 
-#define VERSION 0.33
+#define VERSION 0.41
 #define FD 1                /* (unused) file number for cbm_routines */
 
 #define FL_STEPTO      0x00
@@ -57,6 +73,13 @@
 #define IMAGE_NIB      0    /* destination image format */
 #define IMAGE_D64      1
 #define IMAGE_G64      2
+#define IMAGE_NBZ      3
+#define IMAGE_STREAM   4
+
+#define MAX_READS      16   /* D64 mode: reads of a track at most */
+#define STABLE_ERROR_READS 4 /* same error this often: give up on sector */
+#define MAX_TIMEOUTS   3    /* failed transfers before a track is put back */
+#define RETRY_READS    100  /* default second pass budget (-n) */
 
 static int start_track;
 static int end_track;
@@ -70,6 +93,9 @@ static int drivetype;
 static unsigned int floppybytes;
 static int disktype;
 static int imagetype;
+static int retry_reads;     /* second pass budget: track reads */
+static int retry_seconds;   /* second pass budget: seconds, 0 no limit */
+static struct nbz_writer nbz;
 
 char bitrate_range[4] =
 { 43*2, 31*2, 25*2, 18*2 };
@@ -81,16 +107,27 @@ static BYTE density_branch[4] =
 { 0xb1, 0xb5, 0xb7, 0xb9 };
 
 BYTE track_density[84];
+BYTE track_failed[84];      /* the last read of this halftrack timed out */
 
 
 void usage(void)
 {
     fprintf(stderr, "usage: mnib <output>\n");
+    fprintf(stderr, " output: .nib, .nbz (packed nib) or .d64 image\n");
+    fprintf(stderr, "         - for streaming nib to stdout\n");
     fprintf(stderr, " -b: Bump before reading\n");
     fprintf(stderr, " -d: Use scanned density\n");
     fprintf(stderr, " -h: Add Halftracks\n");
     fprintf(stderr, " -r: Reset Drives\n");
+    fprintf(stderr, " -p: Write streaming nib (to a pipe)\n");
+    fprintf(stderr, " -n<reads>: Reads again of the tracks that failed or\n");
+    fprintf(stderr, "     did not settle (default %d)\n", RETRY_READS);
+    fprintf(stderr, " -s<seconds>: Time limit of these reads\n");
     fprintf(stderr, " -35: 35 tracks only\n");
+    fprintf(stderr, " -tname[:arg]: Drive transport, lpt (default),\n");
+    fprintf(stderr, "     lpt:emu:image (emulated port and drive with an image),\n");
+    fprintf(stderr, "     sim:image (simulated drive with a nib/nbz/g64 image)\n");
+    fprintf(stderr, "     or pipe:requests,answers (drive of cbmserve)\n");
 
     exit(1);
 }
@@ -196,7 +233,7 @@ int verify_floppy()
 int find_par_port()
 {
     int i;
-    for (i = 0; set_par_port(i); i++)
+    for (i = 0; cbm_set_par_port(i); i++)
     {
         if (test_par_port())
         {
@@ -214,7 +251,7 @@ int set_full_track()
     cbm_par_write(FD, 0xfc); /* $1c00 CLEAR mask (clear stepper bits) */
     cbm_par_write(FD, 0x02); /* $1c00  SET  mask (stepper bits = %10) */
     cbm_par_read(FD);
-    delay(500); /* wait for motor to step */
+    cbm_delay(500); /* wait for motor to step */
 }
 
 int motor_on()
@@ -223,7 +260,7 @@ int motor_on()
     cbm_par_write(FD, 0xf3); /* $1c00 CLEAR mask */
     cbm_par_write(FD, 0x0c); /* $1c00  SET  mask (LED + motor ON) */
     cbm_par_read(FD);
-    delay(500); /* wait for motor to turn on */
+    cbm_delay(500); /* wait for motor to turn on */
 }
 
 int motor_off()
@@ -232,7 +269,7 @@ int motor_off()
     cbm_par_write(FD, 0xf3); /* $1c00 CLEAR mask */
     cbm_par_write(FD, 0x00); /* $1c00  SET  mask (LED + motor OFF) */
     cbm_par_read(FD);
-    delay(500); /* wait for motor to turn on */
+    cbm_delay(500); /* wait for motor to turn on */
 }
 
 int step_to_halftrack(int halftrack)
@@ -251,11 +288,11 @@ int reset_floppy()
     step_to_halftrack(36);
     send_par_cmd(FL_RESET);
     printf("drive reset...\n");
-    delay(5000);
+    cbm_delay(5000);
     cbm_listen(FD,8,15);
     cbm_write(FD,"I",1);
     cbm_unlisten(FD);
-    delay(5000);
+    cbm_delay(5000);
     sprintf(cmd,"M-E%c%c",0x00,0x03);
     cbm_listen(FD,8,15);
     cbm_write(FD,cmd,5);
@@ -289,7 +326,15 @@ int set_default_bitrate(int track) /* $13bc */
 }
 
 
-int scan_track(int track) /* $152b Density Scan*/
+/* start the density scan: the drive looks for a killer track for a
+   revolution, the host is free until finish_scan() */
+void start_scan(int track)
+{
+    set_default_bitrate(track);
+    send_par_cmd(FL_SCANKILLER); /* scan for killer track */
+}
+
+int finish_scan(int track)
 {
     BYTE density;
     BYTE killer_info;
@@ -302,8 +347,7 @@ int scan_track(int track) /* $152b Density Scan*/
     unsigned int density_isgood[4];
 
 
-    density = set_default_bitrate(track);
-    send_par_cmd(FL_SCANKILLER); /* scan for killer track */
+    for (density = 3; track >= bitrate_range[density]; density--);
     killer_info = cbm_par_read(FD);
     if (killer_info & 0x80) return (density | killer_info);
     set_bitrate(2);
@@ -348,6 +392,12 @@ int scan_track(int track) /* $152b Density Scan*/
     return(density | killer_info);
 }
 
+int scan_track(int track) /* $152b Density Scan*/
+{
+    start_scan(track);
+    return (finish_scan(track));
+}
+
 
 int scan_density(void)
 {
@@ -373,20 +423,77 @@ int scan_density(void)
 
 
 
-int read_halftrack(int halftrack, BYTE *buffer)
+/* step to a halftrack and start its scan, the drive works on it while
+   the host saves or decodes the track before.  Only the killer scan
+   (about one revolution) overlaps with the host, the track transfer
+   does not.  The host needs far less than a revolution per track, so
+   the Linux build does not use a thread for it either. */
+void start_halftrack(int halftrack)
+{
+    step_to_halftrack(halftrack);
+    start_scan(halftrack);
+}
+
+/* read the track under the head with a known density, without sync
+   if nosync is set.  Returns 0 if the transfer timed out MAX_TIMEOUTS
+   times. */
+int read_track_data(BYTE *buffer, int density, int nosync)
+{
+    int timeout;
+    int tries;
+
+    tries = 0;
+    do
+    {
+        send_par_cmd(FL_DENSITY);
+        cbm_par_write(FD, density_branch[density]);
+        cbm_par_write(FD, 0x9f);                   /* $1c00 CLEAR mask */
+        cbm_par_write(FD, bitrate_value[density]); /* $1c00  SET  mask */
+        cbm_par_read(FD);
+
+        fflush(NULL);
+
+        cbm_disable();
+         
+        if (nosync)
+            send_par_cmd(FL_READWOSYNC);
+        else
+            send_par_cmd(FL_READNORMAL);
+        cbm_par_read(FD);
+
+        timeout = (cbm_nib_read_track(FD, buffer, 0x2000) < 0x2000);
+        cbm_enable();
+        if (timeout)
+        {
+            printf("r");
+            printf("%02x\n", cbm_par_read(FD));
+            cbm_delay(500);
+            printf(".\n");
+            printf("%02x\n", cbm_par_read(FD));
+            cbm_delay(500);
+            printf("%02x ", cbm_par_read(FD));
+            cbm_delay(500);
+            printf("%02x ", cbm_par_read(FD));
+            fprintf(stderr, "%s", test_par_port() ? "+" : "-");
+        }
+    } while (timeout && (++tries < MAX_TIMEOUTS));
+
+    cbm_par_read(FD);
+    return (!timeout);
+}
+
+int finish_halftrack(int halftrack, BYTE *buffer)
 {
     int density, defdensity;
     int scanned_density;
-    int timeout;
-    int byte;
-    int i;
 
-    step_to_halftrack(halftrack);
     printf("\n%4.1f: ",(float)halftrack/2);
     for (defdensity = 3; halftrack >= bitrate_range[defdensity]; defdensity--);
     printf("(%d) ", (defdensity & 3));
 
-    scanned_density = scan_track(halftrack);
+    scanned_density = finish_scan(halftrack);
+    track_density[halftrack] = scanned_density;
+    track_failed[halftrack] = 0;
     if (scanned_density & 0x80)
     {
         /* killer track */
@@ -412,60 +519,57 @@ int read_halftrack(int halftrack, BYTE *buffer)
 
     printf(" -> %d", density);
 
-    do
-    {
-        send_par_cmd(FL_DENSITY);
-        cbm_par_write(FD, density_branch[density]);
-        cbm_par_write(FD, 0x9f);                   /* $1c00 CLEAR mask */
-        cbm_par_write(FD, bitrate_value[density]); /* $1c00  SET  mask */
-        cbm_par_read(FD);
+    track_failed[halftrack] =
+        !read_track_data(buffer, density, scanned_density & 0x40);
+    return (density);
+}
 
-        fflush(NULL);
 
-        disable();
-         
-        if (scanned_density & 0x40)
-            send_par_cmd(FL_READWOSYNC);
-        else
-            send_par_cmd(FL_READNORMAL);
-        cbm_par_read(FD);
+/* read a halftrack again with the density of its last scan
+   Returns 0 if the transfer failed. */
+int reread_halftrack(int halftrack, BYTE *buffer, int density)
+{
+    step_to_halftrack(halftrack);
+    track_failed[halftrack] =
+        !read_track_data(buffer, density, track_density[halftrack] & 0x40);
+    return (!track_failed[halftrack]);
+}
 
-        timeout = 0;
-        for (i = 0; i < 0x2000; i+=2)
-        {
-            byte = cbm_nib_read1(FD);
-            if (byte < 0)
-            {
-                timeout = 1;
-                break;
-            }
-            buffer[i] = byte;
-            byte = cbm_nib_read2(FD);
-            if (byte < 0)
-            {
-                timeout = 1;
-                break;
-            }
-            buffer[i+1] = byte;
-        }
-        enable();
-        if (timeout)
-        {
-            printf("r");
-            printf("%02x\n", cbm_par_read(FD));
-            delay(500);
-            printf(".\n");
-            printf("%02x\n", cbm_par_read(FD));
-            delay(500);
-            printf("%02x ", cbm_par_read(FD));
-            delay(500);
-            printf("%02x ", cbm_par_read(FD));
-            fprintf(stderr, "%s", test_par_port() ? "+" : "-");
-        }
-    } while (timeout);
 
-    cbm_par_read(FD);
-    return (density);
+/* the queued halftrack to read next: the next one in the direction the
+   head moves, at the last one the direction turns (elevator order).
+   Every queued halftrack is read once in a sweep.
+   Returns 0 if none is queued. */
+int next_halftrack(BYTE *queued, int halftrack, int *direction)
+{
+    int ht;
+
+    for (ht = halftrack + *direction; (ht >= 2) && (ht < 84);
+         ht += *direction)
+        if (queued[ht]) return (ht);
+
+    *direction = -*direction;
+    for (ht = halftrack; (ht >= 2) && (ht < 84); ht += *direction)
+        if (queued[ht]) return (ht);
+    return (0);
+}
+
+
+/* anything left of the second pass budget (-n, -s)? */
+int budget_left(int reads, unsigned long start)
+{
+    if (reads >= retry_reads) return (0);
+    if ((retry_seconds > 0)
+        && (cbm_msec() - start >= (unsigned long) retry_seconds * 1000))
+        return (0);
+    return (1);
+}
+
+
+int read_halftrack(int halftrack, BYTE *buffer)
+{
+    start_halftrack(halftrack);
+    return (finish_halftrack(halftrack, buffer));
 }
 
 
@@ -475,12 +579,37 @@ int readdisk(FILE *fpout, char *track_header)
     int density;
     int header_entry;
     BYTE buffer[0x2100];
+    BYTE queued[84];    /* tracks to read again in the second pass */
+    int problems;
+    int reads, direction;
+    unsigned long start;
     int i;
 
     header_entry = 0;
+    problems = 0;
+    reads = 0;
+    start = 0;
+    memset(queued, 0, sizeof(queued));
+    start_halftrack(start_track);
     for (track = start_track; track <= end_track; track += track_inc)
     {
-        density = read_halftrack(track, buffer);
+        density = finish_halftrack(track, buffer);
+
+        /* a streaming nib cannot take the track later, so it is read
+           again right here, from the same budget */
+        if (track_failed[track] && (imagetype == IMAGE_STREAM))
+        {
+            if (reads == 0) start = cbm_msec();
+            while (track_failed[track] && budget_left(reads, start))
+            {
+                printf("\n%4.1f: again -> %d", (float)track/2, density);
+                reads++;
+                if (reread_halftrack(track, buffer, density)) printf(" OK");
+            }
+        }
+
+        if (track + track_inc <= end_track)
+            start_halftrack(track + track_inc);
         track_header[header_entry*2] = track;
 
         if (density & 0x80)
@@ -490,49 +619,237 @@ int readdisk(FILE *fpout, char *track_header)
         else
             track_header[header_entry*2+1] = density;
 
-        header_entry++;
+        /* the data of a failed track is not to be trusted, the flag
+           stays until the track is read */
+        if (track_failed[track])
+        {
+            track_header[header_entry*2+1] |= NIB_TRACK_FAILED;
+            problems++;
+            if (imagetype != IMAGE_STREAM)
+            {
+                printf(" later");
+                queued[track] = 1;
+            }
+        }
 
         /* process and save track to disk */
-        for (i = 0; i < 0x2000; i++)
-            fputc(buffer[i], fpout);
+        if (imagetype == IMAGE_NBZ)
+            write_nbz_track(&nbz, buffer);
+        else
+        {
+            /* streaming nib: header entry in front of each track */
+            if (imagetype == IMAGE_STREAM)
+            {
+                fputc(track_header[header_entry*2], fpout);
+                fputc(track_header[header_entry*2+1], fpout);
+            }
+            for (i = 0; i < 0x2000; i++)
+                fputc(buffer[i], fpout);
+            if (imagetype == IMAGE_STREAM) fflush(fpout);
+        }
+
+        header_entry++;
+    }
+
+    /* second pass: the tracks that failed, as long as the budget lasts */
+    reads = 0;
+    direction = -1;
+    track = end_track;
+    start = cbm_msec();
+    while ((problems > 0) && (imagetype != IMAGE_STREAM)
+           && budget_left(reads, start))
+    {
+        track = next_halftrack(queued, track, &direction);
+        header_entry = (track - start_track) / track_inc;
+        density = track_header[header_entry*2+1] & ~NIB_TRACK_FAILED;
+
+        printf("\n%4.1f: again -> %d", (float)track/2, density);
+        reads++;
+        if (!reread_halftrack(track, buffer, density)) continue;
+
+        printf(" OK");
+        queued[track] = 0;
+        problems--;
+        track_header[header_entry*2+1] &= ~NIB_TRACK_FAILED;
+        if (imagetype == IMAGE_NBZ)
+            replace_nbz_track(&nbz, header_entry, buffer);
+        else
+        {
+            fseek(fpout, 0x100 + (long) header_entry * 0x2000, SEEK_SET);
+            fwrite((char *) buffer, 0x2000, 1, fpout);
+            fseek(fpout, 0, SEEK_END);
+        }
     }
+    if (problems > 0)
+        printf("\n%d track%s failed, budget used up, marked in the header",
+               problems, (problems == 1) ? "" : "s");
     step_to_halftrack(4*2);
 }
 
 
 
+/* all reads of a track in D64 mode so far */
+struct track_reads
+{
+    int reads;                /* number of reads */
+    int density;              /* density of the first read */
+    int any_sectors;          /* any valid sectors on track at all? */
+    int count[21];            /* number of different sector data read */
+    int occur[21][MAX_READS]; /* how many times was this sector data read? */
+    int error[21][MAX_READS]; /* type of error on this sector data */
+    int use[21];              /* best data for this sector so far */
+    int done[21];             /* best data is settled, not decoded again */
+    unsigned long time;       /* msec spent on the track */
+    BYTE data[MAX_READS*21*260];
+};
+
+
+/* add a read of the track in buffer to its sector data
+   Returns 1 if the track is settled and needs no more reads. */
+int add_track_read(struct track_reads *tr, BYTE *buffer, int track, BYTE *id)
+{
+    BYTE* gcr_cycle;
+    struct track_index index;
+    BYTE rawdata[260];
+    BYTE errorcode;
+    int sector;
+    int csec; /* compare sector variable */
+    int score, sector_max;
+    int goodtrack;
+
+    gcr_cycle = find_track_cycle(buffer);
+    index_GCR_track(buffer, gcr_cycle, &index);
+
+/*
+    if (gcr_cycle != NULL) printf(" cycle: %d ", gcr_cycle-buffer); 
+*/
+
+    tr->reads++;
+    goodtrack = 1;
+    for (sector = 0; sector < sector_map_1541[track]; sector++)
+    {
+        if (tr->done[sector]) continue;
+
+        /* convert sector to free sector buffer */
+        errorcode = convert_indexed_sector(&index, rawdata,
+                                           track, sector, id);
+
+        if (errorcode == OK) tr->any_sectors = 1;
+
+        /* check, if identical sector has been read before */
+        for (csec = 0; csec < tr->count[sector]; csec++)
+        {
+            if ((memcmp(tr->data+(21*csec+sector)*260, rawdata, 260) == 0)
+                && (tr->error[sector][csec] == errorcode))
+            {
+                tr->occur[sector][csec] += 1;
+                break;
+            }
+        }
+        if (csec == tr->count[sector])
+        {
+            /* sectordaten sind neu, kopieren, zaehler erhoehen */
+            memcpy(tr->data+(21*csec+sector)*260, rawdata, 260);
+            tr->occur[sector][csec] = 1;
+            tr->error[sector][csec] = errorcode;
+            tr->count[sector] += 1;
+        }
+
+        /* best data: most often read, errors count 8 less */
+        tr->use[sector] = 0;
+        sector_max = -MAX_READS;
+        for (csec = 0; csec < tr->count[sector]; csec++)
+        {
+            score = tr->occur[sector][csec]
+                    - ((tr->error[sector][csec] == OK) ? 0 : 8);
+            if (score > sector_max)
+            {
+                tr->use[sector] = csec;
+                sector_max = score;
+            }
+        }
+
+        /* settled: error free data read in most of the reads, or
+           the same error every time for STABLE_ERROR_READS reads */
+        csec = tr->use[sector];
+        if (tr->error[sector][csec] == OK)
+            tr->done[sector] = (2 * tr->occur[sector][csec] > tr->reads);
+        else
+            tr->done[sector] =
+                (tr->occur[sector][csec] >= STABLE_ERROR_READS)
+                && (tr->occur[sector][csec] == tr->reads);
+
+        if (!tr->done[sector])
+            goodtrack = 0;
+    } /* for sector.... */
+
+    if (goodtrack == 1) return (1);
+    if (tr->density & 0x80) return (1); /* killer track reads the same */
+    if ((tr->reads == 2) && (tr->any_sectors == 0)) return (1);
+    return (tr->reads >= MAX_READS);
+}
+
+
+/* copy the best data of each sector to the D64 image */
+void keep_track(struct track_reads *tr, int track,
+                BYTE *d64ptr, BYTE *errorinfo)
+{
+    int sector;
+    BYTE errorcode;
+
+    printf(" ");
+    for (sector = 0; sector < sector_map_1541[track]; sector++)
+    {
+        printf("%d",sector);
+
+        /* no read of the track came through */
+        if (tr->count[sector] == 0)
+        {
+            memset(d64ptr, 0x01, 256);
+            errorcode = SYNC_NOT_FOUND;
+        }
+        else
+        {
+            memcpy(d64ptr, tr->data+1+(21*tr->use[sector]+sector)*260, 256);
+            errorcode = tr->error[sector][tr->use[sector]];
+        }
+        d64ptr += 256;
+        errorinfo[sector] = errorcode;
+
+        /* screen information */
+        if (errorcode == OK)
+            printf(" ");
+        else
+            printf("%d",errorcode);
+    }
+    printf(" %2d read%s %5.2fs", tr->reads, (tr->reads == 1) ? " " : "s",
+           (float) tr->time / 1000);
+}
+
+
 int read_d64(FILE *fpout)
 {
     int density;
-    int track, sector;
-    int csec; /* compare sector variable */
+    int track;
     int blockindex;
     int save_errorinfo;
     int save_40_errors;
     int save_40_tracks;
-    int retry;
     BYTE buffer[0x2100];
-    BYTE* gcr_cycle;
     BYTE id[3];
-    BYTE rawdata[260];
-    BYTE sectordata[16*21*260];
     BYTE d64data[MAXBLOCKSONDISK*256];
-    BYTE *d64ptr;
     BYTE errorinfo[MAXBLOCKSONDISK];
-    BYTE errorcode;
-    int sector_count[21];     /* number of different sector data read */
-    int sector_occur[21][16]; /* how many times was this sector data read? */
-    int sector_error[21][16]; /* type of error on this sector data */
-    int sector_use[21];       /* best data for this sector so far */
-    int sector_max[21];       /* # of times the best sector data has occured */
-    int goodtrack;
-    int goodsector;
-    int any_sectors;           /* any valid sectors on track at all? */
+    int first_block[41];          /* block number of sector 0 */
+    struct track_reads *tr[41];   /* tracks of the second pass */
+    BYTE queued[84];
+    int problems;
+    int started;               /* halftrack started in the drive, or 0 */
     int blocks_to_save;
+    int reads, direction;
+    unsigned long start, read_start;
 
 
 
-    blockindex = 0;
     save_errorinfo = 0;
     save_40_errors = 0;
     save_40_tracks = 0;
@@ -544,111 +861,116 @@ int read_d64(FILE *fpout)
         return (0);
     }
 
-    d64ptr = d64data;
+    blockindex = 0;
     for (track = 1; track <= 40; track += 1)
     {
-        /* no sector data read in yet */
-        for (sector = 0; sector < 21; sector++)
-            sector_count[sector] = 0;
+        first_block[track] = blockindex;
+        blockindex += sector_map_1541[track];
+    }
 
-        any_sectors = 0;
-        for (retry = 0; retry < 16; retry++)
+    /* first pass: each track is read once, the tracks with sectors
+       that did not settle are kept for the second pass */
+    memset(queued, 0, sizeof(queued));
+    problems = 0;
+    started = 0;
+    start = cbm_msec();
+    for (track = 1; track <= 40; track += 1)
+    {
+        tr[track] = calloc(1, sizeof(struct track_reads));
+        if (tr[track] == NULL)
         {
-            goodtrack = 1;
-            read_halftrack(2*track, buffer);
-            gcr_cycle = find_track_cycle(buffer);
+            fprintf(stderr, "Cannot allocate track data.\n");
+            if (started != 0) cbm_par_read(FD);
+            for (track--; track >= 1; track--)
+                if (queued[2*track]) free(tr[track]);
+            return (0);
+        }
 
-/*
-            if (gcr_cycle != NULL) printf(" cycle: %d ", gcr_cycle-buffer); 
-*/
+        read_start = cbm_msec();
+        if (started != 2*track) start_halftrack(2*track);
+        tr[track]->density = finish_halftrack(2*track, buffer);
 
-            for (sector = 0; sector < sector_map_1541[track]; sector++)
-            {
-                sector_max[sector] = 0;
-                /* convert sector to free sector buffer */
-                errorcode = convert_GCR_sector(buffer, gcr_cycle, rawdata,
-                                               track, sector, id);
-
-                if (errorcode == OK) any_sectors = 1;
-
-                /* check, if identical sector has been read before */
-                for (csec = 0; csec < sector_count[sector]; csec++)
-                {
-                    if ((memcmp(sectordata+(21*csec+sector)*260, rawdata, 260)
-                        == 0) && (sector_error[sector][csec] == errorcode))
-                    {
-                        sector_occur[sector][csec] += 1;
-                        break;
-                    }
-                }
-                if (csec == sector_count[sector])
-                {
-                    /* sectordaten sind neu, kopieren, zaehler erhoehen */
-                    memcpy(sectordata+(21*csec+sector)*260, rawdata, 260);
-                    sector_occur[sector][csec] = 1;
-                    sector_error[sector][csec] = errorcode;
-                    sector_count[sector] += 1;
-                }
-
-                goodsector = 0;
-                for (csec = 0; csec < sector_count[sector]; csec++)
-                {
-                    if (sector_occur[sector][csec]-((sector_error[sector][csec]==OK)?0:8)
-                        > sector_max[sector])
-                    {
-                        sector_use[sector] = csec;
-                        sector_max[sector] = csec;
-                    }
-
-                    if (sector_occur[sector][csec]-((sector_error[sector][csec]==OK)?0:8)
-                        > (retry / 2 + 1))
-                    {
-                        goodsector = 1;
-                    }
-                }
-                if (goodsector == 0)
-                    goodtrack = 0;
-            } /* for sector.... */
-            if (goodtrack == 1) break; /* break out of for loop */
-            if ((retry == 1) && (any_sectors==0)) break;
-        } /* for retry.... */
-
-
-        /* keep the best data for each sector */
-
-        for (sector = 0; sector < sector_map_1541[track]; sector++)
-        {
-            printf("%d",sector);
+        /* the drive scans the next track while this one is decoded */
+        started = (track < 40) ? 2*(track+1) : 0;
+        if (started != 0) start_halftrack(started);
 
-            memcpy(d64ptr, sectordata+1+(21*sector_use[sector]+sector)*260,
-                   256);
-            d64ptr += 256;
+        /* a read that timed out gets no vote */
+        if (!track_failed[2*track]
+            && add_track_read(tr[track], buffer, track, id))
+        {
+            tr[track]->time = cbm_msec() - read_start;
+            keep_track(tr[track], track, d64data + first_block[track]*256,
+                       errorinfo + first_block[track]);
+            free(tr[track]);
+        }
+        else
+        {
+            tr[track]->time = cbm_msec() - read_start;
+            printf(" later");
+            queued[2*track] = 1;
+            problems++;
+        }
+    }
+    printf("\nfirst pass: %d tracks to read again, %.2fs", problems,
+           (float) (cbm_msec() - start) / 1000);
+
+    /* second pass: one more read for each queued track per sweep of the
+       head, as long as the budget lasts */
+    reads = 0;
+    direction = -1;
+    track = 40;
+    start = cbm_msec();
+    while ((problems > 0) && budget_left(reads, start))
+    {
+        track = next_halftrack(queued, 2*track, &direction) / 2;
 
-            errorcode = sector_error[sector][sector_use[sector]];
-            errorinfo[blockindex] = errorcode;
+        printf("\n%4.1f: again", (float)track);
+        read_start = cbm_msec();
+        reads++;
+        if (!reread_halftrack(2*track, buffer, tr[track]->density))
+        {
+            tr[track]->time += cbm_msec() - read_start;
+            continue;
+        }
+        if (add_track_read(tr[track], buffer, track, id))
+        {
+            tr[track]->time += cbm_msec() - read_start;
+            keep_track(tr[track], track, d64data + first_block[track]*256,
+                       errorinfo + first_block[track]);
+            free(tr[track]);
+            queued[2*track] = 0;
+            problems--;
+        }
+        else
+            tr[track]->time += cbm_msec() - read_start;
+    }
+    if (problems > 0)
+        printf("\nbudget used up, best data of the other tracks");
+    for (track = 1; track <= 40; track += 1)
+    {
+        if (!queued[2*track]) continue;
+        printf("\n%4.1f: ", (float)track);
+        keep_track(tr[track], track, d64data + first_block[track]*256,
+                   errorinfo + first_block[track]);
+        free(tr[track]);
+    }
+    printf("\nsecond pass: %d reads, %.2fs\n", reads,
+           (float) (cbm_msec() - start) / 1000);
 
-            if (errorcode != OK)
-            {
-                if (track <= 35)
-                    save_errorinfo = 1;
-                else
-                    save_40_errors = 1;
-            }
-            else if (track > 35)
-            {
-                save_40_tracks = 1;
-            }
-   
-            /* screen information */
-            if (errorcode == OK)
-                printf(" ");
+    for (blockindex = 0; blockindex < MAXBLOCKSONDISK; blockindex++)
+    {
+        if (errorinfo[blockindex] != OK)
+        {
+            if (blockindex < BLOCKSONDISK)
+                save_errorinfo = 1;
             else
-                printf("%d",errorcode);
-            blockindex++;
-       }
-
-
-    } /* track loop */
+                save_40_errors = 1;
+        }
+        else if (blockindex >= BLOCKSONDISK)
+        {
+            save_40_tracks = 1;
+        }
+    }
 
     blocks_to_save = (save_40_tracks) ? MAXBLOCKSONDISK : BLOCKSONDISK;
 
@@ -678,6 +1000,7 @@ int main(int argc, char *argv[])
     int byte;
     int fd;
     int bump, reset;
+    int stream;
     BYTE buffer[500];
     BYTE error[500];
     BYTE cmd[80];
@@ -688,9 +1011,6 @@ int main(int argc, char *argv[])
     FILE *fpout;
 
 
-    printf("\nmnib - Commodore G64 disk image nibbler v%.2f", VERSION);
-    printf("\n (C) 2000,01 Markus Brenner\n\n");
-
     bump = reset = 0;
     start_track = 1*2;
     end_track = 41*2;
@@ -698,8 +1018,13 @@ int main(int argc, char *argv[])
     use_default_density = 1;
     no_extra_tracks = 0;
     disktype = DISK_NORMAL;
+    stream = 0;
+    retry_reads = RETRY_READS;
+    retry_seconds = 0;
+    init_GCR_kernels();
 
-    while (--argc && (*(++argv)[0] == '-'))
+    /* a single "-" is the output, not an option */
+    while (--argc && (*(++argv)[0] == '-') && ((*argv)[1] != '\0'))
     {
         switch (tolower((*argv)[1]))
         {
@@ -718,6 +1043,18 @@ int main(int argc, char *argv[])
             case 'g':
                 disktype = DISK_GEOS;
                 break;
+            case 'p':
+                stream = 1;
+                break;
+            case 'n':
+                retry_reads = atoi(*argv + 2);
+                break;
+            case 's':
+                retry_seconds = atoi(*argv + 2);
+                break;
+            case 't':
+                if (!cbm_set_transport(*argv + 2)) exit(3);
+                break;
             case '3':
                 no_extra_tracks = 1; 
                 end_track = 35*2;
@@ -731,31 +1068,66 @@ int main(int argc, char *argv[])
     if (argc < 1) usage();
 
     strcpy(outname, argv[0]);
-    if ((fpout = fopen(outname,"wb")) == NULL)
+    if (strcmp(outname, "-") == 0)
+    {
+        /* the image goes to stdout, all messages to stderr */
+        stream = 1;
+#if defined(__DJGPP__)
+        setmode(fileno(stdout), O_BINARY);
+#endif
+        fpout = fdopen(dup(fileno(stdout)), "wb");
+        dup2(fileno(stderr), fileno(stdout));
+    }
+    else
+        fpout = fopen(outname,"wb");
+    if (fpout == NULL)
     {
         fprintf(stderr, "Couldn't open output file %s!\n", outname);
         exit(2);
     }
 
-    if (compare_extension(outname, "D64"))
+    printf("\nmnib - Commodore G64 disk image nibbler v%.2f", VERSION);
+    printf("\n (C) 2000,01 Markus Brenner\n\n");
+
+    if (stream)
+        imagetype = IMAGE_STREAM;
+    else if (compare_extension(outname, "D64"))
         imagetype = IMAGE_D64;
     else if (compare_extension(outname, "G64"))
         imagetype = IMAGE_G64;
+    else if (compare_extension(outname, "NBZ"))
+        imagetype = IMAGE_NBZ;
     else
         imagetype = IMAGE_NIB;
 
     /* write NIB-header if appropriate */
-    if (imagetype == IMAGE_NIB)
+    if ((imagetype == IMAGE_NIB) || (imagetype == IMAGE_NBZ))
     {
         memset(header, 0x00, 0x100);
         sprintf(header, "MNIB-1541-RAW%c%c%c",1,0,0);
+    }
+    else if (imagetype == IMAGE_STREAM)
+    {
+        /* entries are written in front of each track, see readdisk() */
+        memset(header, 0x00, 0x100);
+        sprintf(header, "MNIB-1541-STR%c%c%c",1,0,0);
+        fwrite(header, 0x10, 1, fpout);
+        fflush(fpout);
+    }
+    if (imagetype == IMAGE_NIB)
+    {
         for (i = 0; i < 0x100; i++)
         {
             fputc(header[i], fpout);
         }
     }
+    else if (imagetype == IMAGE_NBZ)
+    {
+        /* NBZ header and track index are written at the end */
+        if (!create_nbz(&nbz, fpout)) exit(2);
+    }
 
-    if (!detect_ports(reset)) exit (3);
+    if (!cbm_init(reset)) exit (3);
 
     /* prepare error string $73: CBM DOS V2.6 1541 */
     sprintf(cmd,"M-W%c%c%c%c%c%c%c%c",0,3,5,0xa9,0x73,0x4c,0xc1,0xe6);
@@ -777,13 +1149,13 @@ int main(int argc, char *argv[])
     if (bump)
     {
         /* perform a bump */
-        delay(1000);
+        cbm_delay(1000);
         printf("Bumping...\n");
         sprintf(cmd,"M-W%c%c%c%c%c",6,0,2,1,0);
         cbm_exec_command(fd, 8, cmd, 8);
         sprintf(cmd,"M-W%c%c%c%c",0,0,1,0xc0);
         cbm_exec_command(fd, 8, cmd, 7);
-        delay(2500);
+        cbm_delay(2500);
     }
 
     cbm_exec_command(fd, 8, "U0>M0", 0);
@@ -808,7 +1180,8 @@ int main(int argc, char *argv[])
     motor_on();
 
 
-    if (imagetype == IMAGE_NIB)
+    if ((imagetype == IMAGE_NIB) || (imagetype == IMAGE_NBZ)
+        || (imagetype == IMAGE_STREAM))
         readdisk(fpout, header+0x10);
     else if (imagetype == IMAGE_D64)
         read_d64(fpout);
@@ -827,6 +1200,14 @@ int main(int argc, char *argv[])
         }
         fseek(fpout, 0, SEEK_END);
     }
+    else if (imagetype == IMAGE_NBZ)
+        close_nbz(&nbz, (BYTE *) header);
+    else if (imagetype == IMAGE_STREAM)
+    {
+        /* end of stream */
+        fputc(0, fpout);
+        fputc(0, fpout);
+    }
 
     fclose(fpout);
 
@@ -834,7 +1215,7 @@ int main(int argc, char *argv[])
     step_to_halftrack(36);
     send_par_cmd(FL_RESET);
     printf("drive reset...\n");
-    delay(2000);
+    cbm_delay(2000);
 
     return 1;
 }
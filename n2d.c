@@ -9,161 +9,260 @@
     V 0.21   split program in n2d.c and gcr.h/gcr.c
     V 0.22   added halftrack-image support
     V 0.23   improved/fixed conversion
+    V 0.24   scan each track only once using a track index
+    V 0.25   added batch mode (-b)
+    V 0.26   tracks are converted independently, D64 is written at once
+    V 0.27   read image with image.c, tracks are not copied
+    V 0.28   reads streaming NIB from stdin (-), tracks as they arrive
+    V 0.29   added per-track result cache (-c)
+    V 0.30   tracks mnib failed to read give error sectors
+    V 0.31   tracks are converted by jobs, on all processors under Linux
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "cache.h"
+#include "jobs.h"
 
 
-#define VERSION 0.23
+#define VERSION 0.31
+
+
+static int verbose = 1;     /* print sector status while converting */
+static int use_cache = 0;   /* results of tracks are kept in cache */
+static struct result_cache cache;
+
+
+/* the tracks of one image, converted by convert_track_job() */
+struct nib_tracks
+{
+    struct disk_image *image;
+    BYTE *d64data;
+    BYTE *errorinfo;
+    BYTE *id;
+    int errors[35];         /* sectors with errors, -1: track not found */
+    int failed[35];         /* mnib failed to read the track */
+};
 
 
 void usage(void)
 {
-    fprintf(stderr, "Usage: n2d data [d64image]\n\n");
+    fprintf(stderr, "Usage: n2d [-c cachedir] data [d64image]\n"
+                    "       n2d [-c cachedir] - d64image   (streaming data from stdin)\n"
+                    "       n2d [-c cachedir] -b data|directory|@manifest ...\n\n");
     exit (-1);
 }
 
 
-int main(int argc, char **argv)
+/* convert one track, using the cached result if there is one
+   Returns the number of sectors with errors. */
+static int convert_track(BYTE *gcr_track, int track_len, BYTE *d64data,
+                         BYTE *errorinfo, int track, BYTE *id)
 {
-    FILE *fp_nib, *fp_d64;
-    char nibname[1024], d64name[1024];
+    char converter[40];
+    DWORD key[2];
+    BYTE result[21 * 257];      /* sectors and error codes */
+    BYTE track_id[3];
+    BYTE *cycle;
+    int blockindex, sectors;
+    int errors;
+    int i;
+
+    blockindex = d64_block_offset(track);
+    sectors = sector_map_1541[track];
+
+    if (use_cache)
+    {
+        sprintf(converter, "n2d %.2f gcr %.2f", VERSION, GCR_VERSION);
+        start_cache_key(key, converter);
+        track_id[0] = track;
+        track_id[1] = id[0];
+        track_id[2] = id[1];
+        add_cache_key(key, track_id, 3);
+        add_cache_key(key, gcr_track, track_len);
+
+        lock_jobs();
+        i = find_cached(&cache, key, result, sizeof(result));
+        unlock_jobs();
+        if (i == sectors * 257)
+        {
+            memcpy(d64data + blockindex*256, result, sectors * 256);
+            memcpy(errorinfo + blockindex, result + sectors * 256, sectors);
+            for (errors = 0, i = 0; i < sectors; i++)
+                if (errorinfo[blockindex + i] != OK) errors++;
+            return (errors);
+        }
+    }
+
+    cycle = find_track_cycle(gcr_track);
+
+    /* FIXME: maybe improve for cycle == NULL */
+    errors = convert_track_to_d64(gcr_track, cycle, d64data, errorinfo,
+                                  track, id);
+
+    if (use_cache)
+    {
+        memcpy(result, d64data + blockindex*256, sectors * 256);
+        memcpy(result + sectors * 256, errorinfo + blockindex, sectors);
+        lock_jobs();
+        store_cached(&cache, key, result, sectors * 257);
+        unlock_jobs();
+    }
+    return (errors);
+}
+
+
+/* fill the sectors of a track mnib could not read, like a track without
+   sync.  Returns the number of sectors with errors. */
+static int failed_track(BYTE *d64data, BYTE *errorinfo, int track)
+{
+    int blockindex, sectors;
+
+    blockindex = d64_block_offset(track);
+    sectors = sector_map_1541[track];
+    memset(d64data + blockindex*256, 0x01, sectors * 256);
+    memset(errorinfo + blockindex, SYNC_NOT_FOUND, sectors);
+    return (sectors);
+}
+
+
+/* convert one track of the image, a job of run_jobs()
+   The image is only used under the job lock, a streaming image is read
+   as the jobs ask for its tracks. */
+static void convert_track_job(void *context, int index)
+{
+    struct nib_tracks *tracks;
+    BYTE *gcr_track;
+    int track_len;
+
+    tracks = context;
+    lock_jobs();
+    gcr_track = image_track(tracks->image, (index + 1) * 2, &track_len);
+    tracks->failed[index] = image_track_failed(tracks->image,
+                                               (index + 1) * 2);
+    unlock_jobs();
+
+    if (gcr_track == NULL)
+        tracks->errors[index] = -1;
+    else if (tracks->failed[index])
+        tracks->errors[index] = failed_track(tracks->d64data,
+                                             tracks->errorinfo, index + 1);
+    else
+        tracks->errors[index] = convert_track(gcr_track, track_len,
+                                              tracks->d64data,
+                                              tracks->errorinfo,
+                                              index + 1, tracks->id);
+}
+
+
+/* convert one NIB image, returns 0 on success, -1 on failure
+   *errors is set to the number of sectors with errors */
+int convert_nib(char *nibname, char *d64name, int *errors)
+{
+    FILE *fp_d64;
+    struct disk_image image;
+    struct nib_tracks tracks;
     int track, sector;
     BYTE id[3];
-    BYTE gcr_track[GCR_TRACK_LENGTH], rawdata[260];
+    BYTE *gcr_track;
+    int track_len;
+    BYTE *d64data;
     BYTE errorinfo[MAXBLOCKSONDISK];
     BYTE errorcode;
-    int save_errorinfo;
     int blockindex;
-    BYTE nib_header[0x100];
-    int header_offset;
-    BYTE *cycle;
-	
+    int status;
 
-    fprintf(stdout,
-"\ng2d is a small stand-alone converter to convert a G64 disk image to\n"
-"a standard D64 disk image.  Copyright 1999 Markus Brenner.\n"
-"This is free software, covered by the GNU General Public License.\n"
-"Version %.2f\n\n", VERSION);
+    *errors = 0;
+    status = -1;
 
-    if (argc == 2)
-    {
-        char *dot;
-        strcpy(nibname, argv[1]);
-        strcpy(d64name, nibname);
-        dot = strrchr(d64name, '.');
-        if (dot != NULL)
-            strcpy(dot, ".d64");
-        else
-            strcat(d64name, ".d64");
-    }
-    else if (argc == 3)
+    d64data = malloc(BLOCKSONDISK*256);
+    if (d64data == NULL)
     {
-        strcpy(nibname, argv[1]);
-        strcpy(d64name, argv[2]);
+        fprintf(stderr, "Cannot allocate D64 buffer.\n");
+        return (-1);
     }
-    else usage();
 
-    fp_nib = fopen(nibname, "rb");
-    if (fp_nib == NULL)
+    if (!open_image(&image, nibname))
     {
-        fprintf(stderr, "Cannot open NIB image %s.\n", nibname);
-        exit (-1);
+        free(d64data);
+        return (-1);
     }
 
     fp_d64 = fopen(d64name, "wb");
     if (fp_d64 == NULL)
     {
         fprintf(stderr, "Cannot open D64 image %s.\n", d64name);
-        exit (-1);
-    }
-
-    if (fread(nib_header, sizeof(BYTE), 0x0100, fp_nib) < 0x0100)
-    {
-        fprintf(stderr, "Cannot read nibble image header.\n");
-        goto fail;
+        close_image(&image);
+        free(d64data);
+        return (-1);
     }
 
     /* figure out the disk ID from Track 18, Sector 0 */
     id[0]=id[1]=id[2] = '\0';
-    if (nib_header[0x10+17*2] == 18*2) /* normal nibble file */
-        fseek(fp_nib, 17*GCR_TRACK_LENGTH+0x100, SEEK_SET);
-    else /* halftrack nibble file */
-        fseek(fp_nib, 2*17*GCR_TRACK_LENGTH+0x100, SEEK_SET);
-
-    if (fread(gcr_track, sizeof(BYTE), GCR_TRACK_LENGTH, fp_nib) < GCR_TRACK_LENGTH)
+    gcr_track = image_track(&image, 18*2, &track_len);
+    if (gcr_track == NULL)
     {
         fprintf(stderr, "Cannot read track from G64 image.\n");
         goto fail;
     }
+    if (image_track_failed(&image, 18*2))
+    {
+        fprintf(stderr, "Track 18 was not read by mnib.\n");
+        goto fail;
+    }
     if (!extract_id(gcr_track, id))
     {
         fprintf(stderr, "Cannot find directory sector.\n");
         goto fail;
     }
-    printf("ID: %2x %2x\n", id[0], id[1]);
+    if (verbose) printf("ID: %2x %2x\n", id[0], id[1]);
 
-    /* reset file pointer to first track */
-    fseek(fp_nib, 0x100, SEEK_SET);
+    /* halftracks in the image are skipped, each track fills its own
+       blocks of d64data and errorinfo */
+    tracks.image = &image;
+    tracks.d64data = d64data;
+    tracks.errorinfo = errorinfo;
+    tracks.id = id;
+    run_jobs(35, convert_track_job, &tracks);
 
-    blockindex = 0;
-    save_errorinfo = 0;
-    header_offset = 0x10; /* number of first nibble-track in nib image */
     for (track = 0; track < 35; track++)
     {
-        /* Skip halftracks if present in image */
-        if (nib_header[header_offset] < (track + 1) * 2)
-        {
-            fseek(fp_nib, GCR_TRACK_LENGTH, SEEK_CUR); 
-            header_offset += 2;
-        }
-        header_offset += 2;
-
-	/* read in one track */
-        if (fread(gcr_track, sizeof(BYTE), GCR_TRACK_LENGTH, fp_nib) < GCR_TRACK_LENGTH)
+        if (tracks.errors[track] < 0)
         {
             fprintf(stderr, "Cannot read track from G64 image.\n");
             goto fail;
         }
+        if (tracks.failed[track])
+            fprintf(stderr, "Track %d was not read by mnib.\n", track + 1);
+        *errors += tracks.errors[track];
 
+        if (!verbose) continue;
         printf("\nTrack: %2d - Sector: ",track+1);
-
-        cycle = find_track_cycle(gcr_track);
-
-        /* FIXME: maybe improve for cycle == NULL */
-
+        blockindex = d64_block_offset(track + 1);
         for (sector = 0; sector < sector_map_1541[track + 1]; sector++)
         {
             printf("%d",sector);
-
-            errorcode = convert_GCR_sector(gcr_track, cycle,
-                                           rawdata,
-                                           track + 1, sector, id);
-
-            errorinfo[blockindex] = errorcode;	/* OK by default */
-            if (errorcode != OK) save_errorinfo = 1;
-          
+            errorcode = errorinfo[blockindex++];
             if (errorcode == OK)
                 printf(" ");
             else
                 printf("%d",errorcode);
-
-            if (fwrite((char *) rawdata+1, 256, 1, fp_d64) != 1)
-            {
-                fprintf(stderr, "Cannot write sector data.\n");
-                goto fail;
-            }
-
-            blockindex++;
         }
     }
 
     /* Missing: Track 36-40 detection */
 
-    if (save_errorinfo)
+    if (fwrite((char *) d64data, BLOCKSONDISK*256, 1, fp_d64) != 1)
+    {
+        fprintf(stderr, "Cannot write sector data.\n");
+        goto fail;
+    }
+
+    if (*errors != 0)
     {
         if (fwrite((char *) errorinfo, BLOCKSONDISK, 1, fp_d64) != 1)
         {
@@ -171,8 +270,61 @@ int main(int argc, char **argv)
             goto fail;
         }
     }
+    status = 0;
 
 fail:
+    close_image(&image);
     fclose(fp_d64);
-    return -1;
+    free(d64data);
+    return (status);
+}
+
+
+int main(int argc, char **argv)
+{
+    char nibname[1024], d64name[1024];
+    int errors;
+
+    fprintf(stdout,
+"\ng2d is a small stand-alone converter to convert a G64 disk image to\n"
+"a standard D64 disk image.  Copyright 1999 Markus Brenner.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    init_GCR_kernels();
+
+    /* the cache file is closed on exit */
+    if ((argc >= 3) && (strcmp(argv[1], "-c") == 0))
+    {
+        if (!open_cache(&cache, argv[2])) return (-1);
+        use_cache = 1;
+        argc -= 2;
+        argv += 2;
+    }
+
+    if ((argc >= 3) && (strcmp(argv[1], "-b") == 0))
+    {
+        verbose = 0;
+        return (run_batch(argc-2, argv+2, ".nib", ".d64", convert_nib));
+    }
+
+    if ((argc == 2) && (strcmp(argv[1], "-") != 0))
+    {
+        char *dot;
+        strcpy(nibname, argv[1]);
+        strcpy(d64name, nibname);
+        dot = strrchr(d64name, '.');
+        if (dot != NULL)
+            strcpy(dot, ".d64");
+        else
+            strcat(d64name, ".d64");
+    }
+    else if (argc == 3)
+    {
+        strcpy(nibname, argv[1]);
+        strcpy(d64name, argv[2]);
+    }
+    else usage();
+
+    return (convert_nib(nibname, d64name, &errors));
 }
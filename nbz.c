@@ -0,0 +1,297 @@
+/* nbz.c - packed NIB images
+
+    (C) 2026 mnib contributors
+
+    A packed NIB image (NBZ) has the 0x100 byte header of a NIB image,
+    only the magic is "MNIB-1541-PCK".  It is followed by an index with
+    one DWORD file offset per header entry, then the packed tracks.
+    Each track is packed on its own, so single tracks can be unpacked
+    without touching the rest of the image.
+
+    Packed track: WORD number of token bytes, WORD length of the track
+    cycle (0 if none was found), then the tokens:
+
+        $00-$3f          n+1 literal bytes follow
+        $40-$7f          (n & $3f)+1 GCR groups follow, each decoded
+                         to 4 bytes (5 GCR bytes without bad quintets)
+        $80-$bf  b       (n & $3f)+3 times byte b (syncs and gaps)
+        $c0-$df  l       copy ((n & $1f) << 8 | l)+3 bytes from 5 bytes
+                         back (sectors filled with one value)
+        $e0-$ff  l       copy ((n & $1f) << 8 | l)+3 bytes from one
+                         track cycle back (the repeated revolution)
+
+    A track always unpacks to GCR_TRACK_LENGTH bytes.
+
+    V 0.10   first version
+    V 0.11   tracks can be replaced after they were written
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nbz.h"
+
+
+#define MAX_LITERAL (0x3f + 1)
+#define MAX_GROUPS  (0x3f + 1)
+#define MAX_RUN   (0x3f + 3)
+#define MAX_COPY  (0x1fff + 3)
+
+
+static int match_len(BYTE *gcr_track, int pos, int distance, int max)
+{
+    int len;
+
+    if ((distance == 0) || (distance > pos)) return (0);
+    for (len = 0; (len < max)
+                  && (gcr_track[pos + len] == gcr_track[pos + len - distance]);
+         len++);
+    return (len);
+}
+
+
+/* decode a GCR group at pos into plain, returns 0 if it is not valid
+   GCR, so encoding plain again would not give the same bytes */
+static int pack_group(BYTE *gcr_track, int pos, BYTE *plain)
+{
+    BYTE gcr[5];
+
+    if (pos + 5 > GCR_TRACK_LENGTH) return (0);
+    convert_4bytes_from_GCR(gcr_track + pos, plain);
+    convert_4bytes_to_GCR(plain, gcr);
+    return (memcmp(gcr, gcr_track + pos, 5) == 0);
+}
+
+
+/* pack one NIB track, returns the size of the packed track
+   packed must hold NBZ_TRACK_MAX bytes.  Every token but a literal saves
+   at least one byte, which pays for the literal token behind it, so
+   only the first and full literal tokens can make the track larger.
+   That's why GCR groups are only started with two valid groups. */
+int pack_track(BYTE *gcr_track, BYTE *packed)
+{
+    int cycle, confidence;
+    int pos, out, literal, groups;
+    int max, run, group, repeat, len;
+    BYTE plain[4], next[4];
+
+    cycle = find_track_cycle_len(gcr_track, &confidence);
+
+    out = 4;
+    literal = groups = -1;
+    pos = 0;
+    while (pos < GCR_TRACK_LENGTH)
+    {
+        max = GCR_TRACK_LENGTH - pos;
+        if (max > MAX_COPY) max = MAX_COPY;
+
+        repeat = match_len(gcr_track, pos, cycle, max);
+        group = match_len(gcr_track, pos, 5, max);
+        for (run = 1; (run < max) && (run < MAX_RUN)
+                      && (gcr_track[pos + run] == gcr_track[pos]); run++);
+
+        if ((repeat >= 3) && (repeat >= group) && (repeat >= run))
+        {
+            len = repeat;
+            packed[out++] = 0xe0 | ((len - 3) >> 8);
+            packed[out++] = (len - 3) & 0xff;
+        }
+        else if ((group >= 3) && (group >= run))
+        {
+            len = group;
+            packed[out++] = 0xc0 | ((len - 3) >> 8);
+            packed[out++] = (len - 3) & 0xff;
+        }
+        else if (run >= 3)
+        {
+            len = run;
+            packed[out++] = 0x80 | (len - 3);
+            packed[out++] = gcr_track[pos];
+        }
+        else if (pack_group(gcr_track, pos, plain)
+                 && ((groups >= 0) || pack_group(gcr_track, pos + 5, next)))
+        {
+            literal = -1;
+            if ((groups < 0) || (packed[groups] == 0x40 + MAX_GROUPS - 1))
+            {
+                groups = out++;
+                packed[groups] = 0x40;
+            }
+            else packed[groups]++;
+            memcpy(packed + out, plain, 4);
+            out += 4;
+            pos += 5;
+            continue;
+        }
+        else
+        {
+            groups = -1;
+            if ((literal < 0) || (packed[literal] == MAX_LITERAL - 1))
+            {
+                literal = out++;
+                packed[literal] = 0;
+            }
+            else packed[literal]++;
+            packed[out++] = gcr_track[pos++];
+            continue;
+        }
+
+        literal = groups = -1;
+        pos += len;
+    }
+
+    packed[0] = (out - 4) % 256;
+    packed[1] = (out - 4) / 256;
+    packed[2] = cycle % 256;
+    packed[3] = cycle / 256;
+    return (out);
+}
+
+
+/* unpack a packed track of at most size bytes into gcr_track
+   Returns 1 on success, 0 if the packed data is damaged. */
+int unpack_track(BYTE *packed, int size, BYTE *gcr_track)
+{
+    int cycle, distance;
+    int in, pos, len, from;
+    BYTE token;
+
+    if (size < 4) return (0);
+    len = packed[0] | (packed[1] << 8);
+    if (len + 4 > size) return (0);
+    size = len + 4;
+    cycle = packed[2] | (packed[3] << 8);
+
+    in = 4;
+    pos = 0;
+    while (in < size)
+    {
+        token = packed[in++];
+        if (token < 0x40)
+        {
+            len = token + 1;
+            if ((in + len > size) || (pos + len > GCR_TRACK_LENGTH))
+                return (0);
+            memcpy(gcr_track + pos, packed + in, len);
+            in += len;
+        }
+        else if (token < 0x80)
+        {
+            len = ((token & 0x3f) + 1) * 5;
+            if ((in + len / 5 * 4 > size) || (pos + len > GCR_TRACK_LENGTH))
+                return (0);
+            convert_bytes_to_GCR(packed + in, gcr_track + pos, len / 5);
+            in += len / 5 * 4;
+        }
+        else if (token < 0xc0)
+        {
+            len = (token & 0x3f) + 3;
+            if ((in >= size) || (pos + len > GCR_TRACK_LENGTH)) return (0);
+            memset(gcr_track + pos, packed[in++], len);
+        }
+        else
+        {
+            if (in >= size) return (0);
+            len = (((token & 0x1f) << 8) | packed[in++]) + 3;
+            distance = (token < 0xe0) ? 5 : cycle;
+            if ((distance == 0) || (distance > pos)
+                || (pos + len > GCR_TRACK_LENGTH))
+                return (0);
+
+            /* source and destination may overlap */
+            for (from = pos - distance; len > 0; len--)
+                gcr_track[pos++] = gcr_track[from++];
+            continue;
+        }
+        pos += len;
+    }
+
+    return (pos == GCR_TRACK_LENGTH);
+}
+
+
+/* start a packed NIB image in fp, header and index are written by
+   close_nbz().  Returns 1 on success, 0 on failure. */
+int create_nbz(struct nbz_writer *nbz, FILE *fp)
+{
+    BYTE header[NBZ_HEADER_SIZE + NBZ_INDEX_SIZE];
+
+    memset(nbz, 0, sizeof(struct nbz_writer));
+    nbz->fp = fp;
+
+    memset(header, 0, sizeof(header));
+    if (fwrite((char *) header, sizeof(header), 1, fp) != 1)
+    {
+        fprintf(stderr, "Cannot write NBZ header.\n");
+        return (0);
+    }
+    nbz->pos = sizeof(header);
+    return (1);
+}
+
+
+/* pack and append the next track, in the order of the header entries
+   Returns 1 on success, 0 on failure. */
+int write_nbz_track(struct nbz_writer *nbz, BYTE *gcr_track)
+{
+    if (nbz->tracks >= NBZ_TRACKS) return (0);
+    if (!replace_nbz_track(nbz, nbz->tracks, gcr_track)) return (0);
+    nbz->tracks++;
+    return (1);
+}
+
+
+/* pack and append a track for header entry, a track written before
+   for the same entry is left unused in the file
+   Returns 1 on success, 0 on failure. */
+int replace_nbz_track(struct nbz_writer *nbz, int entry, BYTE *gcr_track)
+{
+    BYTE packed[NBZ_TRACK_MAX];
+    int size;
+
+    if ((entry < 0) || (entry >= NBZ_TRACKS)) return (0);
+
+    size = pack_track(gcr_track, packed);
+    fseek(nbz->fp, nbz->pos, SEEK_SET);
+    if (fwrite((char *) packed, size, 1, nbz->fp) != 1)
+    {
+        fprintf(stderr, "Cannot write track data.\n");
+        return (0);
+    }
+
+    nbz->track_offset[entry] = nbz->pos;
+    nbz->pos += size;
+    return (1);
+}
+
+
+/* write header and index, nib_header is the 0x100 byte NIB header
+   of the tracks.  The file is not closed.
+   Returns 1 on success, 0 on failure. */
+int close_nbz(struct nbz_writer *nbz, BYTE *nib_header)
+{
+    BYTE header[NBZ_HEADER_SIZE + NBZ_INDEX_SIZE];
+    BYTE *index;
+    int i;
+
+    memcpy(header, nib_header, NBZ_HEADER_SIZE);
+    memcpy(header, NBZ_MAGIC, strlen(NBZ_MAGIC));
+
+    index = header + NBZ_HEADER_SIZE;
+    for (i = 0; i < NBZ_TRACKS; i++)
+    {
+        index[i*4] = nbz->track_offset[i] & 0xff;
+        index[i*4 + 1] = (nbz->track_offset[i] >> 8) & 0xff;
+        index[i*4 + 2] = (nbz->track_offset[i] >> 16) & 0xff;
+        index[i*4 + 3] = (nbz->track_offset[i] >> 24) & 0xff;
+    }
+
+    fseek(nbz->fp, 0, SEEK_SET);
+    if (fwrite((char *) header, sizeof(header), 1, nbz->fp) != 1)
+    {
+        fprintf(stderr, "Cannot write NBZ header.\n");
+        return (0);
+    }
+    fseek(nbz->fp, 0, SEEK_END);
+    return (1);
+}
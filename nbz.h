@@ -0,0 +1,47 @@
+/* nbz.h - packed NIB images
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version
+*/
+
+#ifndef _NBZ_
+#define _NBZ_
+
+#include <stdio.h>
+#include "gcr.h"
+
+
+#define NBZ_MAGIC "MNIB-1541-PCK"       /* replaces "MNIB-1541-RAW" */
+#define NBZ_HEADER_SIZE 0x100
+#define NBZ_TRACKS ((0x100 - 0x10) / 2) /* entries in the NIB header */
+#define NBZ_INDEX_SIZE (NBZ_TRACKS * 4)
+
+/* max. size of a packed track: block header and all literals */
+#define NBZ_TRACK_MAX (4 + GCR_TRACK_LENGTH + GCR_TRACK_LENGTH / 64 + 1)
+
+
+/* a packed NIB image being written, see create_nbz() */
+struct nbz_writer
+{
+    FILE *fp;
+    long pos;           /* file offset for the next track */
+    int tracks;         /* number of tracks written */
+    DWORD track_offset[NBZ_TRACKS];
+};
+
+
+int pack_track(BYTE *gcr_track, BYTE *packed);
+
+int unpack_track(BYTE *packed, int size, BYTE *gcr_track);
+
+int create_nbz(struct nbz_writer *nbz, FILE *fp);
+
+int write_nbz_track(struct nbz_writer *nbz, BYTE *gcr_track);
+
+int replace_nbz_track(struct nbz_writer *nbz, int entry, BYTE *gcr_track);
+
+int close_nbz(struct nbz_writer *nbz, BYTE *nib_header);
+
+
+#endif
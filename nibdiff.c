@@ -0,0 +1,399 @@
+/* nibdiff.c - compares two NIB, NBZ or G64 dumps of the same disk
+
+    (C) 2026 mnib contributors
+
+    The track cycles of both images are compared on GCR level, so a
+    re-dump can be checked against an earlier one without converting
+    both to D64.  Tracks are first aligned by rotation, equal cycles are
+    reported as the same.  Otherwise the block headers of both cycles
+    are matched by track and sector and the header, the data block, the
+    syncs in front of them and the gaps are compared.  Tracks without
+    block headers are compared byte by byte at the best rotation.
+
+    NIB and NBZ tracks are extracted like n2g does, so a NIB image can
+    be compared with the G64 image made from it, too.
+
+    V 0.10   first version
+    V 0.11   tracks mnib failed to read count as no cycle
+    V 0.12   no static track indexes, images are compared by jobs
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "extract.h"
+
+#define VERSION 0.12
+
+
+/* GCR bytes of a data block (65 groups) */
+#define DATA_BLOCK_GCR 325
+
+
+static int verbose = 1;         /* print the differences of each track */
+static char *compare_dir;       /* batch: directory of the other images */
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: nibdiff image1 image2\n"
+                    "       nibdiff -b dir image|directory|@manifest ...\n"
+                    " -b: compare each image with the one of the same"
+                    " name in dir\n\n");
+    exit (-1);
+}
+
+
+/* track cycle of a halftrack, cycle length 0 if there is none
+   NIB, NBZ and streaming tracks are extracted into gcr_track, G64
+   tracks are used in place.  A blank G64 track (one sync, then a
+   single byte value) counts as no cycle, as n2g writes those for NIB
+   tracks without a cycle. */
+static void get_cycle(struct disk_image *image, int halftrack,
+                      BYTE *gcr_track, struct track_cycle *cycle)
+{
+    BYTE *track;
+    int track_len;
+    int i;
+
+    set_track_cycle(cycle, gcr_track, gcr_track);
+
+    track = image_track(image, halftrack, &track_len);
+    if ((track == NULL) || image_track_failed(image, halftrack)) return;
+
+    if (image->type != IMAGE_G64)
+    {
+        track_len = extract_cycle(track, gcr_track);
+        set_track_cycle(cycle, gcr_track, gcr_track + track_len);
+        return;
+    }
+
+    for (i = 1; i < track_len; i++)
+        if (track[i] != track[track_len - 1]) break;
+    if (i < track_len)
+        set_track_cycle(cycle, track, track + track_len);
+}
+
+
+/* number of sync bytes in front of pos */
+static int sync_before(struct track_cycle *cycle, int pos)
+{
+    BYTE *gcr_ptr;
+    int len;
+
+    gcr_ptr = cycle->gcr_start + (pos % cycle->track_len);
+    for (len = 0; len < cycle->track_len; len++)
+    {
+        if (gcr_ptr == cycle->gcr_start)
+            gcr_ptr += cycle->track_len;
+        if (*--gcr_ptr != 0xff) break;
+    }
+    return (len);
+}
+
+
+/* number of gap bytes from pos to the next sync */
+static int gap_after(struct track_cycle *cycle, int pos)
+{
+    BYTE *gcr_ptr, *gcr_end;
+    int len;
+
+    gcr_ptr = cycle->gcr_start + (pos % cycle->track_len);
+    gcr_end = cycle->gcr_start + cycle->track_len;
+    for (len = 0; (len < cycle->track_len) && (*gcr_ptr != 0xff); len++)
+        if (++gcr_ptr == gcr_end) gcr_ptr = cycle->gcr_start;
+    return (len);
+}
+
+
+static void print_track(int halftrack)
+{
+    if (halftrack & 1)
+        printf("Track %2d.5:", halftrack / 2);
+    else
+        printf("Track %2d:  ", halftrack / 2);
+}
+
+
+/* block sizes in front of and behind a data block, see below */
+struct block_gaps
+{
+    int data_sync;      /* sync in front of the data block */
+    int gap;            /* header gap, from the header to the data sync */
+    int tail_gap;       /* from the data block to the next sync */
+};
+
+
+static void get_block_gaps(struct track_cycle *cycle,
+                           struct sector_header *entry,
+                           struct block_gaps *gaps)
+{
+    gaps->data_sync = sync_before(cycle, entry->data);
+    gaps->gap = entry->data - gaps->data_sync - entry->pos - 10;
+    gaps->tail_gap = gap_after(cycle, entry->data + DATA_BLOCK_GCR);
+}
+
+
+/* print a difference of two values */
+static void print_value(char *name, int a, int b)
+{
+    if (a != b) printf(" %s %d/%d", name, a, b);
+}
+
+
+/* compare one sector of both tracks, the header of a, the header of b
+   Returns 1 if the sectors differ. */
+static int compare_sector(struct track_cycle *cycle_a,
+                          struct sector_header *a,
+                          struct track_cycle *cycle_b,
+                          struct sector_header *b)
+{
+    BYTE data_a[DATA_BLOCK_GCR], data_b[DATA_BLOCK_GCR];
+    BYTE header[8];
+    struct block_gaps gaps_a, gaps_b;
+    int header_differs;
+    int bytes;
+    int i;
+
+    header_differs = (memcmp(a->gcr, b->gcr, 10) != 0);
+
+    bytes = 0;
+    memset(&gaps_a, 0, sizeof(gaps_a));
+    memset(&gaps_b, 0, sizeof(gaps_b));
+    if ((a->data >= 0) && (b->data >= 0))
+    {
+        copy_cycle_bytes(cycle_a, a->data, data_a, DATA_BLOCK_GCR);
+        copy_cycle_bytes(cycle_b, b->data, data_b, DATA_BLOCK_GCR);
+        for (i = 0; i < DATA_BLOCK_GCR; i++)
+            if (data_a[i] != data_b[i]) bytes++;
+
+        get_block_gaps(cycle_a, a, &gaps_a);
+        get_block_gaps(cycle_b, b, &gaps_b);
+    }
+
+    if (!header_differs && (a->sync_len == b->sync_len)
+        && ((a->data < 0) == (b->data < 0)) && (bytes == 0)
+        && (memcmp(&gaps_a, &gaps_b, sizeof(gaps_a)) == 0))
+        return (0);
+
+    if (verbose)
+    {
+        convert_bytes_from_GCR(a->gcr, header, 2, NULL);
+        printf("  sector %2d:", header[2]);
+        if (header_differs) printf(" header");
+        print_value("header sync", a->sync_len, b->sync_len);
+        if ((a->data < 0) != (b->data < 0))
+            printf(" no data block in %s", (a->data < 0) ? "first"
+                                                          : "second");
+        if (bytes != 0) printf(" data %d bytes", bytes);
+        print_value("data sync", gaps_a.data_sync, gaps_b.data_sync);
+        print_value("gap", gaps_a.gap, gaps_b.gap);
+        print_value("tail gap", gaps_a.tail_gap, gaps_b.tail_gap);
+        printf("\n");
+    }
+    return (1);
+}
+
+
+/* compare the sectors of two track cycles by their block headers
+   Returns the number of sectors that differ or are only in one track. */
+static int compare_sectors(struct track_index *index_a,
+                           struct track_index *index_b)
+{
+    BYTE used[MAX_TRACK_HEADERS];
+    BYTE header[8];
+    struct sector_header *a, *b;
+    int sectors;
+    int i, j;
+
+    /* at most MAX_TRACK_HEADERS each, so this stays linear in the
+       track length */
+    memset(used, 0, sizeof(used));
+    sectors = 0;
+    for (i = 0; i < index_a->headers; i++)
+    {
+        a = &index_a->header[i];
+        for (j = 0, b = index_b->header; j < index_b->headers; j++, b++)
+            if (!used[j] && (a->gcr[4] == b->gcr[4])
+                && (a->gcr[3] == b->gcr[3])
+                && ((a->gcr[2] & 0x0f) == (b->gcr[2] & 0x0f)))
+                break;
+
+        if (j == index_b->headers)
+        {
+            if (verbose)
+            {
+                convert_bytes_from_GCR(a->gcr, header, 2, NULL);
+                printf("  sector %2d: only in first\n", header[2]);
+            }
+            sectors++;
+            continue;
+        }
+        used[j] = 1;
+        sectors += compare_sector(&index_a->cycle, a, &index_b->cycle, b);
+    }
+
+    for (j = 0; j < index_b->headers; j++)
+    {
+        if (used[j]) continue;
+        if (verbose)
+        {
+            convert_bytes_from_GCR(index_b->header[j].gcr, header, 2, NULL);
+            printf("  sector %2d: only in second\n", header[2]);
+        }
+        sectors++;
+    }
+    return (sectors);
+}
+
+
+/* compare one halftrack of both images, returns 1 if they differ */
+static int compare_track(struct disk_image *image_a,
+                         struct disk_image *image_b, int halftrack)
+{
+    struct track_index index_a, index_b;
+    BYTE gcr_a[7928], gcr_b[7928];
+    struct track_cycle cycle_a, cycle_b;
+    int rotation, confidence;
+    int density_a, density_b;
+    int bytes, sectors;
+    int i;
+
+    /* missing tracks are written as blank tracks by n2g, so both
+       count as no cycle */
+    get_cycle(image_a, halftrack, gcr_a, &cycle_a);
+    get_cycle(image_b, halftrack, gcr_b, &cycle_b);
+    if ((cycle_a.track_len == 0) && (cycle_b.track_len == 0)) return (0);
+
+    if (verbose) print_track(halftrack);
+
+    if ((cycle_a.track_len == 0) || (cycle_b.track_len == 0))
+    {
+        if (verbose) printf(" no cycle in %s\n",
+                            (cycle_a.track_len == 0) ? "first" : "second");
+        return (1);
+    }
+
+    density_a = image_density(image_a, halftrack) & 0x03;
+    density_b = image_density(image_b, halftrack) & 0x03;
+
+    rotation = find_cycle_rotation(&cycle_a, &cycle_b, &confidence);
+    if ((cycle_a.track_len == cycle_b.track_len) && (confidence == 100)
+        && (density_a == density_b))
+    {
+        if (verbose) printf(" same\n");
+        return (0);
+    }
+
+    if (verbose)
+    {
+        print_value("density", density_a, density_b);
+        print_value("length", cycle_a.track_len, cycle_b.track_len);
+    }
+
+    index_GCR_track(cycle_a.gcr_start,
+                    cycle_a.gcr_start + cycle_a.track_len, &index_a);
+    index_GCR_track(cycle_b.gcr_start,
+                    cycle_b.gcr_start + cycle_b.track_len, &index_b);
+
+    if ((index_a.headers == 0) && (index_b.headers == 0))
+    {
+        /* no sectors, compare the bytes at the best rotation */
+        if (verbose)
+        {
+            if (rotation < 0)
+                printf(" not aligned\n");
+            else
+            {
+                for (bytes = 0, i = 0; (i < cycle_a.track_len)
+                                       && (i < cycle_b.track_len); i++)
+                    if (cycle_a.gcr_start[i] != cycle_b.gcr_start[
+                            (rotation + i) % cycle_b.track_len])
+                        bytes++;
+                printf(" %d bytes differ\n", bytes);
+            }
+        }
+        return (1);
+    }
+
+    if (verbose)
+    {
+        print_value("syncs", index_a.syncs, index_b.syncs);
+        printf("\n");
+    }
+    sectors = compare_sectors(&index_a, &index_b);
+    if (verbose && (sectors == 0))
+        printf("  sectors are the same\n");
+    return (1);
+}
+
+
+/* compare two images, *errors is set to the number of tracks that
+   differ.  Returns 0 on success, -1 if an image cannot be read. */
+int compare_images(char *name_a, char *name_b, int *errors)
+{
+    struct disk_image image_a, image_b;
+    int halftrack;
+
+    *errors = 0;
+    if (!open_image(&image_a, name_a)) return (-1);
+    if (!open_image(&image_b, name_b))
+    {
+        close_image(&image_a);
+        return (-1);
+    }
+
+    for (halftrack = 2; halftrack < 2 + G64_HALFTRACKS; halftrack++)
+        *errors += compare_track(&image_a, &image_b, halftrack);
+
+    close_image(&image_a);
+    close_image(&image_b);
+    return (0);
+}
+
+
+/* batch: compare inname with the image of the same name in compare_dir */
+int compare_batch(char *inname, char *outname, int *errors)
+{
+    char *base, *ptr;
+
+    for (base = ptr = inname; *ptr != '\0'; ptr++)
+        if ((*ptr == '/') || (*ptr == '\\') || (*ptr == ':'))
+            base = ptr + 1;
+    sprintf(outname, "%s/%s", compare_dir, base);
+
+    return (compare_images(inname, outname, errors));
+}
+
+
+int main(int argc, char **argv)
+{
+    int errors;
+
+    fprintf(stdout,
+"\nnibdiff compares two mnib, NBZ or G64 images of the same disk.\n"
+"Copyright 2026 mnib contributors.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    init_GCR_kernels();
+
+    if ((argc >= 4) && (strcmp(argv[1], "-b") == 0))
+    {
+        verbose = extract_verbose = 0;
+        compare_dir = argv[2];
+        return (run_batch(argc-3, argv+3, ".nib", ".nib", compare_batch));
+    }
+
+    if (argc != 3) usage();
+
+    extract_verbose = 0;
+    if (compare_images(argv[1], argv[2], &errors) != 0) return (-1);
+
+    printf("\n%s\n", (errors == 0) ? "Images are the same."
+                                   : "Images differ.");
+    return ((errors == 0) ? 0 : 1);
+}
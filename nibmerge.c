@@ -0,0 +1,452 @@
+/* nibmerge.c - merges several mnib dumps of one disk by majority vote
+
+    (C) 2026 mnib contributors
+
+    Fragile originals often give a few bad bytes in each dump, but in
+    different places.  nibmerge extracts the track cycles of all dumps
+    like n2g does, aligns them by rotation against the cycle of the most
+    common length and takes each byte that most dumps agree on.  Where
+    there is no majority for a byte, each bit is voted on its own.  This
+    is the offline counterpart of the retries in read_d64() of mnib.
+
+    The merged disk is written as NIB, G64 and D64 image.  For each
+    sector the number of dumps is printed that give the same sector data
+    and error code as the merged track, converted like n2d does.
+
+    Every track is merged on its own from the same track of all dumps,
+    the time is linear in the number of dumps.  The tracks are merged by
+    jobs, on all processors under Linux (see jobs.c).
+
+    V 0.10   first version
+    V 0.11   tracks mnib failed to read take no part in the vote
+    V 0.12   tracks are merged by jobs, buffers are per track
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "extract.h"
+#include "jobs.h"
+
+#define VERSION 0.12
+
+
+/* max. number of dumps, one digit of agreeing dumps per sector */
+#define MAX_DUMPS 9
+
+
+static struct disk_image dump[MAX_DUMPS];
+static int dumps;
+
+/* merged tracks: the cycle repeated to NIB track length, or the raw
+   track of the first dump if no dump has a cycle.  One spare track,
+   extract_id() reads a few bytes behind the end of a track. */
+static BYTE merged[G64_HALFTRACKS + 1][GCR_TRACK_LENGTH];
+static int merged_len[G64_HALFTRACKS];      /* cycle length, 0 if none */
+static int merged_density[G64_HALFTRACKS];  /* -1 if not in any dump */
+static int merged_votes[G64_HALFTRACKS];    /* dumps voted, -1: failed */
+static int merged_by_bits[G64_HALFTRACKS];  /* bytes voted bit by bit */
+
+
+/* cycles of one halftrack of all dumps, as found and as aligned */
+struct merge_buffers
+{
+    BYTE cycle_data[MAX_DUMPS][7928];
+    BYTE aligned[MAX_DUMPS][7928];
+};
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: nibmerge outname dump1 dump2 [dump3 ...]\n"
+                    " writes outname.nib, outname.G64 and outname.d64,"
+                    " up to %d dumps\n\n", MAX_DUMPS);
+    exit (-1);
+}
+
+
+/* majority of the bytes of all voting cycles at pos, bit by bit if
+   there is none.  Ties go to the first cycle, the reference. */
+static BYTE vote_byte(BYTE **cycle, int votes, int pos, int *by_bits)
+{
+    BYTE candidate, value;
+    int count, ones;
+    int bit;
+    int i;
+
+    /* majority candidate in one pass, then count it */
+    candidate = cycle[0][pos];
+    for (count = 0, i = 0; i < votes; i++)
+    {
+        if (count == 0) candidate = cycle[i][pos];
+        if (cycle[i][pos] == candidate)
+            count++;
+        else
+            count--;
+    }
+    for (count = 0, i = 0; i < votes; i++)
+        if (cycle[i][pos] == candidate) count++;
+    if (2*count > votes) return (candidate);
+
+    (*by_bits)++;
+    for (value = 0, bit = 0x80; bit != 0; bit >>= 1)
+    {
+        for (ones = 0, i = 0; i < votes; i++)
+            if (cycle[i][pos] & bit) ones++;
+        if ((2*ones > votes) || ((2*ones == votes) && (cycle[0][pos] & bit)))
+            value |= bit;
+    }
+    return (value);
+}
+
+
+/* merge one halftrack of all dumps into merged[]
+   The dumps are only used under the job lock, NBZ tracks are unpacked
+   on first use.
+   Returns the number of dumps that were voted, -1 on failure. */
+static int merge_track(int halftrack, int *by_bits)
+{
+    struct merge_buffers *buffers;
+    BYTE *vote[MAX_DUMPS];
+    struct track_cycle ref, cycle;
+    BYTE *track, *gcr_track;
+    int cycle_len[MAX_DUMPS];
+    int track_len, len, best;
+    int rotation, confidence;
+    int votes;
+    int count;
+    int failed;
+    int i, j;
+
+    buffers = malloc(sizeof(struct merge_buffers));
+    if (buffers == NULL)
+    {
+        fprintf(stderr, "Cannot allocate buffers for track %d.\n",
+                halftrack / 2);
+        return (-1);
+    }
+
+    gcr_track = merged[halftrack - 2];
+    merged_len[halftrack - 2] = 0;
+    merged_density[halftrack - 2] = -1;
+    *by_bits = 0;
+
+    for (i = 0; i < dumps; i++)
+    {
+        cycle_len[i] = 0;
+        lock_jobs();
+        track = image_track(&dump[i], halftrack, &track_len);
+        failed = (track == NULL) || image_track_failed(&dump[i], halftrack);
+        if (!failed && (merged_density[halftrack - 2] < 0))
+        {
+            merged_density[halftrack - 2] = image_density(&dump[i],
+                                                          halftrack);
+            memcpy(gcr_track, track, GCR_TRACK_LENGTH);
+        }
+        unlock_jobs();
+        if (failed) continue;
+
+        cycle_len[i] = extract_cycle(track, buffers->cycle_data[i]);
+    }
+
+    /* the cycle length most dumps agree on, the first of these dumps
+       is the reference the others are aligned to */
+    len = best = 0;
+    for (i = 0; i < dumps; i++)
+    {
+        if (cycle_len[i] == 0) continue;
+        for (count = 0, j = 0; j < dumps; j++)
+            if (cycle_len[j] == cycle_len[i]) count++;
+        if (count > best)
+        {
+            best = count;
+            len = cycle_len[i];
+        }
+    }
+    if (len == 0)
+    {
+        free(buffers);
+        return (0);
+    }
+
+    votes = 0;
+    for (i = 0; i < dumps; i++)
+    {
+        if (cycle_len[i] != len) continue;
+        if (votes == 0)
+        {
+            set_track_cycle(&ref, buffers->cycle_data[i],
+                            buffers->cycle_data[i] + len);
+            vote[votes++] = buffers->cycle_data[i];
+            continue;
+        }
+
+        set_track_cycle(&cycle, buffers->cycle_data[i],
+                        buffers->cycle_data[i] + len);
+        rotation = find_cycle_rotation(&ref, &cycle, &confidence);
+        if (rotation < 0) continue;
+
+        copy_cycle_bytes(&cycle, rotation, buffers->aligned[i], len);
+        vote[votes++] = buffers->aligned[i];
+    }
+
+    for (i = 0; i < len; i++)
+        gcr_track[i] = vote_byte(vote, votes, i, by_bits);
+    for (i = len; i < GCR_TRACK_LENGTH; i++)
+        gcr_track[i] = gcr_track[i - len];
+
+    merged_len[halftrack - 2] = len;
+    free(buffers);
+    return (votes);
+}
+
+
+/* merge one halftrack, a job of run_jobs() */
+static void merge_track_job(void *context, int index)
+{
+    merged_votes[index] = merge_track(index + 2, &merged_by_bits[index]);
+}
+
+
+/* write the merged tracks as NIB image, header entries in the order
+   of the halftracks */
+static int write_nib(char *name)
+{
+    FILE *fp;
+    BYTE header[0x100];
+    int halftrack, entry;
+    int status;
+
+    fp = fopen(name, "wb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot open NIB image %s.\n", name);
+        return (0);
+    }
+
+    memset(header, 0, sizeof(header));
+    sprintf((char *) header, "MNIB-1541-RAW%c%c%c", 1, 0, 0);
+    entry = 0;
+    for (halftrack = 2; halftrack < 2 + G64_HALFTRACKS; halftrack++)
+    {
+        if (merged_density[halftrack - 2] < 0) continue;
+        if (0x10 + entry*2 >= 0x100) break;
+        header[0x10 + entry*2] = halftrack;
+        header[0x10 + entry*2 + 1] = merged_density[halftrack - 2];
+        entry++;
+    }
+
+    status = (fwrite((char *) header, sizeof(header), 1, fp) == 1);
+    for (entry = 0; status && (entry < (0x100 - 0x10) / 2); entry++)
+    {
+        halftrack = header[0x10 + entry*2];
+        if (halftrack == 0) break;
+        status = (fwrite((char *) merged[halftrack - 2], GCR_TRACK_LENGTH,
+                         1, fp) == 1);
+    }
+    if (!status) fprintf(stderr, "Cannot write NIB image %s.\n", name);
+
+    if (fclose(fp) != 0) status = 0;
+    return (status);
+}
+
+
+/* write the merged tracks as G64 image, like n2g does */
+static int write_g64(char *name)
+{
+    struct g64_writer g64;
+    int halftrack, track;
+    int speed;
+    int status;
+
+    if (!create_g64(&g64, name)) return (0);
+
+    status = 1;
+    for (halftrack = 2; status && (halftrack < 2 + G64_HALFTRACKS);
+         halftrack++)
+    {
+        track = halftrack / 2;
+        if ((merged_density[halftrack - 2] < 0) && (halftrack & 1))
+            continue;
+        speed = (merged_density[halftrack - 2] < 0)
+                ? 0 : merged_density[halftrack - 2] & 0x0f;
+
+        if (merged_len[halftrack - 2] == 0)
+        {
+            if (halftrack & 1) continue;
+            status = write_g64_track(&g64, halftrack, NULL,
+                                     raw_track_size[speed_map_1541[track-1]],
+                                     speed);
+        }
+        else
+            status = write_g64_track(&g64, halftrack, merged[halftrack - 2],
+                                     merged_len[halftrack - 2], speed);
+    }
+
+    if (!close_g64(&g64)) status = 0;
+    return (status);
+}
+
+
+/* write the merged tracks as D64 image and print how many dumps agree
+   with each sector.  Returns the number of sectors with errors, -1 if
+   the image could not be written. */
+static int write_d64(char *name)
+{
+    FILE *fp;
+    static BYTE d64data[BLOCKSONDISK*256];
+    static BYTE dumpdata[BLOCKSONDISK*256];
+    BYTE errorinfo[MAXBLOCKSONDISK];
+    BYTE dumperror[MAXBLOCKSONDISK];
+    int agree[21];
+    BYTE id[3];
+    BYTE *track;
+    int track_len;
+    int t, sector, block;
+    int errors;
+    int i;
+
+    id[0] = id[1] = id[2] = '\0';
+    if ((merged_density[18*2 - 2] < 0) || !extract_id(merged[18*2 - 2], id))
+    {
+        fprintf(stderr, "Cannot find directory sector.\n");
+        return (-1);
+    }
+    printf("\nID: %2x %2x\n", id[0], id[1]);
+
+    errors = 0;
+    for (t = 1; t <= 35; t++)
+    {
+        block = d64_block_offset(t);
+        errors += convert_track_to_d64(merged[t*2 - 2],
+                                       merged_len[t*2 - 2]
+                                       ? merged[t*2 - 2] + merged_len[t*2 - 2]
+                                       : NULL,
+                                       d64data, errorinfo, t, id);
+
+        /* each dump converted on its own, like n2d does */
+        memset(agree, 0, sizeof(agree));
+        for (i = 0; i < dumps; i++)
+        {
+            track = image_track(&dump[i], t*2, &track_len);
+            if ((track == NULL) || image_track_failed(&dump[i], t*2))
+                continue;
+            convert_track_to_d64(track, find_track_cycle(track),
+                                 dumpdata, dumperror, t, id);
+            for (sector = 0; sector < sector_map_1541[t]; sector++)
+                if ((dumperror[block + sector] == errorinfo[block + sector])
+                    && (memcmp(dumpdata + (block + sector)*256,
+                               d64data + (block + sector)*256, 256) == 0))
+                    agree[sector]++;
+        }
+
+        printf("Track: %2d - Dumps agreeing: ", t);
+        for (sector = 0; sector < sector_map_1541[t]; sector++)
+            printf("%d", agree[sector]);
+        printf("   Errors: ");
+        for (sector = 0; sector < sector_map_1541[t]; sector++)
+        {
+            if (errorinfo[block + sector] == OK)
+                printf(".");
+            else
+                printf("%d", errorinfo[block + sector]);
+        }
+        printf("\n");
+    }
+
+    fp = fopen(name, "wb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Cannot open D64 image %s.\n", name);
+        return (-1);
+    }
+    if ((fwrite((char *) d64data, BLOCKSONDISK*256, 1, fp) != 1)
+        || ((errors != 0)
+            && (fwrite((char *) errorinfo, BLOCKSONDISK, 1, fp) != 1)))
+    {
+        fprintf(stderr, "Cannot write D64 image %s.\n", name);
+        errors = -1;
+    }
+    if ((fclose(fp) != 0) && (errors >= 0)) errors = -1;
+    return (errors);
+}
+
+
+int main(int argc, char **argv)
+{
+    char nibname[1024], g64name[1024], d64name[1024];
+    int halftrack;
+    int errors;
+    int status;
+    int i;
+
+    fprintf(stdout,
+"\nnibmerge merges several mnib dumps of one disk by majority vote.\n"
+"Copyright 2026 mnib contributors.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    init_GCR_kernels();
+
+    if ((argc < 4) || (argc - 2 > MAX_DUMPS)) usage();
+
+    make_output_name(argv[1], nibname, ".nib");
+    make_output_name(argv[1], g64name, ".G64");
+    make_output_name(argv[1], d64name, ".d64");
+
+    extract_verbose = 0;
+    for (dumps = 0; dumps < argc - 2; dumps++)
+    {
+        if (strcmp(argv[dumps + 2], nibname) == 0)
+        {
+            fprintf(stderr, "%s would overwrite a dump.\n", nibname);
+            status = -1;
+            goto fail;
+        }
+        if (!open_image(&dump[dumps], argv[dumps + 2]))
+        {
+            status = -1;
+            goto fail;
+        }
+    }
+
+    run_jobs(G64_HALFTRACKS, merge_track_job, NULL);
+
+    for (halftrack = 2; halftrack < 2 + G64_HALFTRACKS; halftrack++)
+    {
+        if (merged_votes[halftrack - 2] < 0)
+        {
+            status = -1;
+            goto fail;
+        }
+        if (merged_density[halftrack - 2] < 0) continue;
+
+        if (halftrack & 1)
+            printf("Track: %2d.5 ", halftrack / 2);
+        else
+            printf("Track: %2d   ", halftrack / 2);
+        if (merged_len[halftrack - 2] == 0)
+            printf("no cycle\n");
+        else
+            printf("%d of %d dumps voted, %d bytes voted by bits\n",
+                   merged_votes[halftrack - 2], dumps,
+                   merged_by_bits[halftrack - 2]);
+    }
+
+    status = -1;
+    if (!write_nib(nibname) || !write_g64(g64name)) goto fail;
+    errors = write_d64(d64name);
+    if (errors < 0) goto fail;
+
+    printf("\n%s, %s, %s written, %d sectors with errors\n",
+           nibname, g64name, d64name, errors);
+    status = 0;
+
+fail:
+    for (i = 0; i < dumps; i++)
+        close_image(&dump[i]);
+    return (status);
+}
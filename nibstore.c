@@ -0,0 +1,669 @@
+/* nibstore.c - track store for archives of NIB and G64 images
+
+    (C) 2026 mnib contributors
+
+    Images are split into tracks, each track is kept only once in the
+    store, no matter how many images use it.  A store is a directory
+    with three files:
+
+    TRACKS.DAT  "MNIB-STORE" header, then each track as a length word
+                followed by the GCR data, in the order they were added
+    TRACKS.IDX  one record per track in TRACKS.DAT: DWORD hash, DWORD
+                offset in TRACKS.DAT, WORD length
+    IMAGES.DIR  one record per image: 64 bytes name, DWORD offset of
+                each halftrack in TRACKS.DAT (0 = not in the image),
+                DWORD speed zone of each halftrack
+
+    NIB tracks are stored as the track cycle n2g extracts, so the same
+    track read at another position gives the same data.  Missing tracks
+    and tracks without a cycle are stored as blank tracks like n2g does.
+    G64 tracks are turned to the same start if the cycle found is the
+    whole track, otherwise they are stored as they are.  Images are
+    written back as G64 images.
+
+    All files are only appended to, adding images is incremental.  The
+    index is kept in a hash table while the store is open, so finding a
+    known track takes one lookup and one read of the stored track.
+
+    V 0.10   first version
+    V 0.11   the store directory is made on first use
+    V 0.12   tracks mnib failed to read are not stored
+    V 0.13   images are added by jobs, the store is used under the job lock
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "extract.h"
+#include "jobs.h"
+
+#define VERSION 0.13
+
+#define STORE_MAGIC "MNIB-STORE"
+#define STORE_HEADER_SIZE 16
+#define INDEX_RECORD_SIZE 10
+#define IMAGE_NAME_SIZE 64
+#define IMAGE_RECORD_SIZE (IMAGE_NAME_SIZE + G64_HALFTRACKS * 8)
+
+/* longest track kept, longer G64 tracks are not stored */
+#define MAX_STORE_TRACK GCR_TRACK_LENGTH
+
+
+/* a track in TRACKS.DAT */
+struct store_track
+{
+    DWORD hash;
+    DWORD offset;
+    int len;
+};
+
+/* an image in IMAGES.DIR */
+struct store_image
+{
+    char name[IMAGE_NAME_SIZE];
+    DWORD track_offset[G64_HALFTRACKS];
+    DWORD speed[G64_HALFTRACKS];
+};
+
+struct track_store
+{
+    FILE *fp_tracks;
+    FILE *fp_index;
+    FILE *fp_images;
+    long tracks_size;       /* size of TRACKS.DAT */
+    struct store_track *track;
+    int tracks, max_tracks;
+    int *table;             /* hash table of track numbers + 1, 0 = empty */
+    int table_size;         /* a power of 2, at least 2 * max_tracks */
+};
+
+
+static struct track_store store;
+static int new_tracks;      /* tracks added to the store */
+static int known_tracks;    /* tracks already in the store */
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: nibstore store image|directory|@manifest ...\n"
+                    "       nibstore -q store image ...\n"
+                    "       nibstore -x store name [g64image]\n"
+                    "       nibstore -l store\n"
+                    " store: directory of the track store, made if it does"
+                    " not exist\n"
+                    " -q: show which tracks of the images are known\n"
+                    " -x: write stored image back as G64 image\n"
+                    " -l: list stored images\n\n");
+    exit (-1);
+}
+
+
+static DWORD get_dword(BYTE *ptr)
+{
+    return (ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((DWORD) ptr[3] << 24));
+}
+
+
+static void put_dword(BYTE *ptr, DWORD value)
+{
+    ptr[0] = value & 0xff;
+    ptr[1] = (value >> 8) & 0xff;
+    ptr[2] = (value >> 16) & 0xff;
+    ptr[3] = (value >> 24) & 0xff;
+}
+
+
+/* FNV-1a hash of a track */
+static DWORD track_hash(BYTE *gcr_track, int len)
+{
+    DWORD hash;
+    int i;
+
+    hash = 2166136261U;
+    for (i = 0; i < len; i++)
+        hash = (hash ^ gcr_track[i]) * 16777619U;
+    return (hash);
+}
+
+
+static FILE *open_store_file(char *dir, char *name)
+{
+    char path[1024];
+    FILE *fp;
+
+    sprintf(path, "%s/%s", dir, name);
+    fp = fopen(path, "r+b");
+    if (fp == NULL) fp = fopen(path, "w+b");
+    if (fp == NULL) fprintf(stderr, "Cannot open store file %s.\n", path);
+    return (fp);
+}
+
+
+/* put a track into the hash table, growing it if needed */
+static int insert_track(struct track_store *st, DWORD hash, DWORD offset,
+                        int len)
+{
+    int *table;
+    int size;
+    int i, slot;
+
+    if (st->tracks == st->max_tracks)
+    {
+        st->max_tracks = st->max_tracks ? 2 * st->max_tracks : 1024;
+        st->track = realloc(st->track,
+                            st->max_tracks * sizeof(struct store_track));
+        if (st->track == NULL) return (0);
+
+        for (size = 1; size < 2 * st->max_tracks; size *= 2);
+        table = calloc(size, sizeof(int));
+        if (table == NULL) return (0);
+        free(st->table);
+        st->table = table;
+        st->table_size = size;
+
+        for (i = 0; i < st->tracks; i++)
+        {
+            slot = st->track[i].hash & (size - 1);
+            while (table[slot] != 0) slot = (slot + 1) & (size - 1);
+            table[slot] = i + 1;
+        }
+    }
+
+    st->track[st->tracks].hash = hash;
+    st->track[st->tracks].offset = offset;
+    st->track[st->tracks].len = len;
+
+    slot = hash & (st->table_size - 1);
+    while (st->table[slot] != 0) slot = (slot + 1) & (st->table_size - 1);
+    st->table[slot] = ++st->tracks;
+    return (1);
+}
+
+
+/* open or create a store, returns 1 on success, 0 on failure */
+static int open_store(struct track_store *st, char *dir)
+{
+    BYTE header[STORE_HEADER_SIZE];
+    BYTE record[INDEX_RECORD_SIZE];
+    DWORD offset;
+    int len;
+    struct stat dir_stat;
+
+    memset(st, 0, sizeof(struct track_store));
+
+    if ((stat(dir, &dir_stat) != 0) && (mkdir(dir, 0777) != 0))
+    {
+        fprintf(stderr, "Cannot create store directory %s.\n", dir);
+        return (0);
+    }
+
+    st->fp_tracks = open_store_file(dir, "TRACKS.DAT");
+    st->fp_index = open_store_file(dir, "TRACKS.IDX");
+    st->fp_images = open_store_file(dir, "IMAGES.DIR");
+    if ((st->fp_tracks == NULL) || (st->fp_index == NULL)
+        || (st->fp_images == NULL))
+        return (0);
+
+    fseek(st->fp_tracks, 0, SEEK_END);
+    st->tracks_size = ftell(st->fp_tracks);
+    if (st->tracks_size == 0)
+    {
+        memset(header, 0, sizeof(header));
+        memcpy(header, STORE_MAGIC, strlen(STORE_MAGIC));
+        if (fwrite((char *) header, sizeof(header), 1, st->fp_tracks) != 1)
+        {
+            fprintf(stderr, "Cannot write store header.\n");
+            return (0);
+        }
+        st->tracks_size = sizeof(header);
+    }
+    else
+    {
+        fseek(st->fp_tracks, 0, SEEK_SET);
+        if ((fread(header, sizeof(header), 1, st->fp_tracks) != 1)
+            || (memcmp(header, STORE_MAGIC, strlen(STORE_MAGIC)) != 0))
+        {
+            fprintf(stderr, "%s is not a track store.\n", dir);
+            return (0);
+        }
+    }
+
+    /* tracks not completely written are ignored */
+    fseek(st->fp_index, 0, SEEK_SET);
+    while (fread(record, INDEX_RECORD_SIZE, 1, st->fp_index) == 1)
+    {
+        offset = get_dword(record + 4);
+        len = record[8] | (record[9] << 8);
+        if (offset + 2 + len > st->tracks_size) continue;
+        if (!insert_track(st, get_dword(record), offset, len))
+        {
+            fprintf(stderr, "Out of memory reading track index.\n");
+            return (0);
+        }
+    }
+    return (1);
+}
+
+
+static void close_store(struct track_store *st)
+{
+    if (st->fp_tracks != NULL) fclose(st->fp_tracks);
+    if (st->fp_index != NULL) fclose(st->fp_index);
+    if (st->fp_images != NULL) fclose(st->fp_images);
+    free(st->track);
+    free(st->table);
+    memset(st, 0, sizeof(struct track_store));
+}
+
+
+/* read a stored track, returns its length, 0 on failure */
+static int read_track(struct track_store *st, DWORD offset, BYTE *gcr_track)
+{
+    BYTE length[2];
+    int len;
+
+    if ((fseek(st->fp_tracks, offset, SEEK_SET) != 0)
+        || (fread(length, 2, 1, st->fp_tracks) != 1))
+        return (0);
+
+    len = length[0] | (length[1] << 8);
+    if ((len == 0) || (len > MAX_STORE_TRACK)) return (0);
+    if (fread(gcr_track, len, 1, st->fp_tracks) != 1) return (0);
+    return (len);
+}
+
+
+/* offset of a track in the store, 0 if it is not known */
+static DWORD find_track(struct track_store *st, BYTE *gcr_track, int len,
+                        DWORD hash)
+{
+    static BYTE stored[MAX_STORE_TRACK];
+    struct store_track *entry;
+    int slot;
+
+    if (st->tracks == 0) return (0);
+
+    slot = hash & (st->table_size - 1);
+    for ( ; st->table[slot] != 0; slot = (slot + 1) & (st->table_size - 1))
+    {
+        entry = &st->track[st->table[slot] - 1];
+        if ((entry->hash != hash) || (entry->len != len)) continue;
+
+        /* same hash, compare the data */
+        if ((read_track(st, entry->offset, stored) == len)
+            && (memcmp(stored, gcr_track, len) == 0))
+            return (entry->offset);
+    }
+    return (0);
+}
+
+
+/* offset of a track in the store, the track is added if it is new
+   Returns 0 on failure. */
+static DWORD add_track(struct track_store *st, BYTE *gcr_track, int len)
+{
+    BYTE record[INDEX_RECORD_SIZE];
+    DWORD hash, offset;
+
+    hash = track_hash(gcr_track, len);
+    offset = find_track(st, gcr_track, len, hash);
+    if (offset != 0)
+    {
+        known_tracks++;
+        return (offset);
+    }
+
+    offset = st->tracks_size;
+    record[0] = len % 256;
+    record[1] = len / 256;
+    fseek(st->fp_tracks, offset, SEEK_SET);
+    if ((fwrite((char *) record, 2, 1, st->fp_tracks) != 1)
+        || (fwrite((char *) gcr_track, len, 1, st->fp_tracks) != 1))
+    {
+        fprintf(stderr, "Cannot write track data.\n");
+        return (0);
+    }
+    st->tracks_size += 2 + len;
+
+    put_dword(record, hash);
+    put_dword(record + 4, offset);
+    record[8] = len % 256;
+    record[9] = len / 256;
+    fseek(st->fp_index, 0, SEEK_END);
+    if (fwrite((char *) record, INDEX_RECORD_SIZE, 1, st->fp_index) != 1)
+    {
+        fprintf(stderr, "Cannot write track index.\n");
+        return (0);
+    }
+
+    if (!insert_track(st, hash, offset, len))
+    {
+        fprintf(stderr, "Out of memory adding track.\n");
+        return (0);
+    }
+    new_tracks++;
+    return (offset);
+}
+
+
+/* the track as it is stored, NULL if the halftrack is not stored
+   *errors is incremented for NIB tracks without a cycle */
+static BYTE *store_track_data(struct disk_image *image, int halftrack,
+                              BYTE *gcr_track, int *len, int *errors)
+{
+    BYTE *track;
+    int track_len;
+
+    track = image_track(image, halftrack, &track_len);
+    if (image_track_failed(image, halftrack)) return (NULL);
+    if (image->type == IMAGE_G64)
+    {
+        if ((track == NULL) || (track_len > MAX_STORE_TRACK)) return (NULL);
+
+        /* the G64 buffer repeats the track, so its cycle is found */
+        *len = extract_track(track, gcr_track);
+        if (*len == track_len) return (gcr_track);
+        *len = track_len;
+        return (track);
+    }
+
+    if ((track == NULL) && (halftrack & 1)) return (NULL);
+
+    *len = 0;
+    if (track != NULL)
+    {
+        *len = extract_cycle(track, gcr_track);
+        if (*len == 0) (*errors)++;
+    }
+    if (*len == 0)
+    {
+        /* missing track or no cycle: blank track like n2g */
+        *len = raw_track_size[speed_map_1541[halftrack / 2 - 1]];
+        memset(gcr_track, 0x55, *len);
+        gcr_track[0] = 0xff;
+    }
+    return (gcr_track);
+}
+
+
+/* position of an image in IMAGES.DIR, -1 if it is not stored */
+static long find_image(struct track_store *st, char *name,
+                       struct store_image *image)
+{
+    BYTE record[IMAGE_RECORD_SIZE];
+    long pos;
+    int i;
+
+    fseek(st->fp_images, 0, SEEK_SET);
+    for (pos = 0; fread(record, IMAGE_RECORD_SIZE, 1, st->fp_images) == 1;
+         pos += IMAGE_RECORD_SIZE)
+    {
+        if (strncmp((char *) record, name, IMAGE_NAME_SIZE) != 0) continue;
+
+        if (image != NULL)
+        {
+            memcpy(image->name, record, IMAGE_NAME_SIZE);
+            for (i = 0; i < G64_HALFTRACKS; i++)
+            {
+                image->track_offset[i] =
+                    get_dword(record + IMAGE_NAME_SIZE + i*4);
+                image->speed[i] =
+                    get_dword(record + IMAGE_NAME_SIZE + G64_HALFTRACKS*4 + i*4);
+            }
+        }
+        return (pos);
+    }
+    return (-1);
+}
+
+
+/* file name of an image without the path */
+static char *image_name(char *path)
+{
+    char *name;
+
+    for (name = path; *path != '\0'; path++)
+        if ((*path == '/') || (*path == '\\') || (*path == ':'))
+            name = path + 1;
+    return (name);
+}
+
+
+/* add one image to the store, returns 0 on success, -1 on failure
+   *errors is set to the number of NIB tracks without a cycle.
+   An image of the same name is replaced. */
+int add_image(char *inname, int *errors)
+{
+    struct disk_image image;
+    struct store_image stored;
+    BYTE record[IMAGE_RECORD_SIZE];
+    BYTE gcr_track[MAX_STORE_TRACK];
+    BYTE *track;
+    int halftrack, entry;
+    int len;
+    long pos;
+    int status;
+
+    *errors = 0;
+    status = -1;
+
+    if (!open_image(&image, inname)) return (-1);
+
+    memset(&stored, 0, sizeof(stored));
+    strncpy(stored.name, image_name(inname), IMAGE_NAME_SIZE - 1);
+
+    for (halftrack = 2; halftrack < 2 + G64_HALFTRACKS; halftrack++)
+    {
+        entry = halftrack - 2;
+        track = store_track_data(&image, halftrack, gcr_track, &len, errors);
+        if (track == NULL) continue;
+
+        lock_jobs();
+        stored.track_offset[entry] = add_track(&store, track, len);
+        unlock_jobs();
+        if (stored.track_offset[entry] == 0) goto fail;
+        stored.speed[entry] = image_density(&image, halftrack);
+        if (image.type != IMAGE_G64) stored.speed[entry] &= 0x0f;
+    }
+
+    memset(record, 0, sizeof(record));
+    memcpy(record, stored.name, IMAGE_NAME_SIZE);
+    for (entry = 0; entry < G64_HALFTRACKS; entry++)
+    {
+        put_dword(record + IMAGE_NAME_SIZE + entry*4,
+                  stored.track_offset[entry]);
+        put_dword(record + IMAGE_NAME_SIZE + G64_HALFTRACKS*4 + entry*4,
+                  stored.speed[entry]);
+    }
+
+    lock_jobs();
+    pos = find_image(&store, stored.name, NULL);
+    if (pos >= 0)
+        fseek(store.fp_images, pos, SEEK_SET);
+    else
+        fseek(store.fp_images, 0, SEEK_END);
+    if (fwrite((char *) record, IMAGE_RECORD_SIZE, 1, store.fp_images) != 1)
+    {
+        unlock_jobs();
+        fprintf(stderr, "Cannot write image directory.\n");
+        goto fail;
+    }
+    fflush(store.fp_tracks);
+    fflush(store.fp_index);
+    fflush(store.fp_images);
+    unlock_jobs();
+    status = 0;
+
+fail:
+    close_image(&image);
+    return (status);
+}
+
+
+/* print how many tracks of an image are already in the store */
+int query_image(char *inname)
+{
+    struct disk_image image;
+    static BYTE gcr_track[MAX_STORE_TRACK];
+    BYTE *track;
+    int halftrack;
+    int len, errors;
+    int tracks, known;
+
+    if (!open_image(&image, inname)) return (-1);
+
+    tracks = known = errors = 0;
+    for (halftrack = 2; halftrack < 2 + G64_HALFTRACKS; halftrack++)
+    {
+        track = store_track_data(&image, halftrack, gcr_track, &len, &errors);
+        if (track == NULL) continue;
+
+        tracks++;
+        if (find_track(&store, track, len, track_hash(track, len)) != 0)
+            known++;
+    }
+    close_image(&image);
+
+    printf("%-40s %2d of %2d tracks known\n", inname, known, tracks);
+    return (0);
+}
+
+
+/* write a stored image as G64 image, returns 0 on success */
+int extract_image(char *name, char *g64name)
+{
+    struct store_image image;
+    struct g64_writer g64;
+    static BYTE gcr_track[MAX_STORE_TRACK];
+    int entry;
+    int len;
+    int status;
+
+    if (find_image(&store, name, &image) < 0)
+    {
+        fprintf(stderr, "Image %s is not in the store.\n", name);
+        return (-1);
+    }
+
+    if (!create_g64(&g64, g64name)) return (-1);
+
+    status = 0;
+    for (entry = 0; entry < G64_HALFTRACKS; entry++)
+    {
+        if (image.track_offset[entry] == 0) continue;
+
+        len = read_track(&store, image.track_offset[entry], gcr_track);
+        if ((len == 0) || !write_g64_track(&g64, entry + 2, gcr_track, len,
+                                           image.speed[entry]))
+        {
+            fprintf(stderr, "Cannot read track %d from store.\n",
+                    (entry + 2) / 2);
+            status = -1;
+            break;
+        }
+    }
+
+    if (!close_g64(&g64)) status = -1;
+    return (status);
+}
+
+
+/* list all stored images */
+int list_images(void)
+{
+    struct store_image image;
+    BYTE record[IMAGE_RECORD_SIZE];
+    long tracks;
+    int images;
+    int entry;
+
+    images = 0;
+    tracks = 0;
+    fseek(store.fp_images, 0, SEEK_SET);
+    while (fread(record, IMAGE_RECORD_SIZE, 1, store.fp_images) == 1)
+    {
+        memcpy(image.name, record, IMAGE_NAME_SIZE);
+        image.name[IMAGE_NAME_SIZE - 1] = '\0';
+        for (entry = 0; entry < G64_HALFTRACKS; entry++)
+            if (get_dword(record + IMAGE_NAME_SIZE + entry*4) != 0)
+                tracks++;
+        printf("%s\n", image.name);
+        images++;
+    }
+
+    printf("\n%d images, %ld tracks, %d different tracks in %ld bytes\n",
+           images, tracks, store.tracks, store.tracks_size);
+    return (0);
+}
+
+
+int main(int argc, char **argv)
+{
+    char mode;
+    int status;
+    int i;
+
+    fprintf(stdout,
+"\nnibstore keeps NIB and G64 disk images in a store of unique tracks.\n"
+"Copyright 2026 mnib contributors.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    mode = 'a';
+    if ((argc > 1) && (argv[1][0] == '-'))
+    {
+        mode = argv[1][1];
+        argc--;
+        argv++;
+    }
+    if (argc < 2) usage();
+
+    if (((mode == 'a') && (argc < 3))
+        || ((mode == 'q') && (argc < 3))
+        || ((mode == 'x') && (argc != 3) && (argc != 4))
+        || ((mode == 'l') && (argc != 2))
+        || (strchr("aqxl", mode) == NULL))
+        usage();
+
+    if (!open_store(&store, argv[1]))
+    {
+        close_store(&store);
+        return (-1);
+    }
+
+    extract_verbose = 0;
+    status = 0;
+    switch (mode)
+    {
+        case 'a':
+            status = run_inputs(argc-2, argv+2, ".nib", add_image);
+            printf("%d tracks added, %d tracks already stored\n",
+                   new_tracks, known_tracks);
+            break;
+        case 'q':
+            for (i = 2; i < argc; i++)
+                if (query_image(argv[i]) != 0) status = -1;
+            break;
+        case 'x':
+            if (argc == 4)
+                status = extract_image(argv[2], argv[3]);
+            else
+            {
+                char g64name[1024];
+                make_output_name(argv[2], g64name, ".g64");
+                status = extract_image(argv[2], g64name);
+            }
+            break;
+        case 'l':
+            status = list_images();
+            break;
+    }
+
+    close_store(&store);
+    return (status);
+}
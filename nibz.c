@@ -0,0 +1,209 @@
+/* nibz.c - packs NIB images to NBZ format and back
+
+    (C) 2026 mnib contributors
+
+    V 0.10   first version
+    V 0.11   fastest GCR encoder is picked at startup
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gcr.h"
+#include "batch.h"
+#include "image.h"
+#include "nbz.h"
+
+#define VERSION 0.11
+
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: nibz [-u] image [outimage]\n"
+                    "       nibz -b [-u] image|directory|@manifest ...\n"
+                    " -u: unpack NBZ image to NIB\n\n");
+    exit (-1);
+}
+
+
+/* number of tracks in the header of a NIB or NBZ image */
+static int header_tracks(struct disk_image *image)
+{
+    int entry;
+
+    for (entry = 0; 0x10 + entry*2 < 0x100; entry++)
+        if (image->data[0x10 + entry*2] == 0) break;
+    return (entry);
+}
+
+
+/* track of a header entry, prints an error if it cannot be read */
+static BYTE *entry_track(struct disk_image *image, int entry)
+{
+    BYTE *track;
+    int halftrack;
+    int track_len;
+
+    halftrack = image->data[0x10 + entry*2];
+    track = image_track(image, halftrack, &track_len);
+    if (track == NULL)
+        fprintf(stderr, "Cannot read track %d from image.\n", halftrack / 2);
+    return (track);
+}
+
+
+/* pack one NIB image, returns 0 on success, -1 on failure */
+int pack_nib(char *inname, char *outname, int *errors)
+{
+    FILE *fpout;
+    struct disk_image image;
+    struct nbz_writer nbz;
+    BYTE *track;
+    int entry;
+    int status;
+
+    *errors = 0;
+    status = -1;
+
+    if (!open_image(&image, inname)) return (-1);
+    if (image.type != IMAGE_NIB)
+    {
+        fprintf(stderr, "%s is not a NIB image.\n", inname);
+        close_image(&image);
+        return (-1);
+    }
+
+    fpout = fopen(outname, "wb");
+    if (fpout == NULL)
+    {
+        fprintf(stderr, "Cannot open NBZ image %s.\n", outname);
+        close_image(&image);
+        return (-1);
+    }
+
+    if (!create_nbz(&nbz, fpout)) goto fail;
+
+    for (entry = 0; entry < header_tracks(&image); entry++)
+    {
+        track = entry_track(&image, entry);
+        if ((track == NULL) || !write_nbz_track(&nbz, track)) goto fail;
+    }
+
+    if (close_nbz(&nbz, image.data)) status = 0;
+
+fail:
+    close_image(&image);
+    if (fclose(fpout) != 0) status = -1;
+    return (status);
+}
+
+
+/* unpack one NBZ image, returns 0 on success, -1 on failure */
+int unpack_nbz(char *inname, char *outname, int *errors)
+{
+    FILE *fpout;
+    struct disk_image image;
+    BYTE header[0x100];
+    BYTE *track;
+    int entry;
+    int status;
+
+    *errors = 0;
+    status = -1;
+
+    if (!open_image(&image, inname)) return (-1);
+    if (image.type != IMAGE_NBZ)
+    {
+        fprintf(stderr, "%s is not a NBZ image.\n", inname);
+        close_image(&image);
+        return (-1);
+    }
+
+    fpout = fopen(outname, "wb");
+    if (fpout == NULL)
+    {
+        fprintf(stderr, "Cannot open NIB image %s.\n", outname);
+        close_image(&image);
+        return (-1);
+    }
+
+    memcpy(header, image.data, 0x100);
+    memcpy(header, "MNIB-1541-RAW", 13);
+    if (fwrite((char *) header, 0x100, 1, fpout) != 1)
+    {
+        fprintf(stderr, "Cannot write NIB header.\n");
+        goto fail;
+    }
+
+    for (entry = 0; entry < header_tracks(&image); entry++)
+    {
+        track = entry_track(&image, entry);
+        if (track == NULL) goto fail;
+        if (fwrite((char *) track, GCR_TRACK_LENGTH, 1, fpout) != 1)
+        {
+            fprintf(stderr, "Cannot write track data.\n");
+            goto fail;
+        }
+    }
+    status = 0;
+
+fail:
+    close_image(&image);
+    if (fclose(fpout) != 0) status = -1;
+    return (status);
+}
+
+
+int main(int argc, char **argv)
+{
+    char inname[1024], outname[1024];
+    int errors;
+    int batch, unpack;
+
+    fprintf(stdout,
+"\nnibz packs mnib nibbler data to NBZ images and unpacks them again.\n"
+"Copyright 2026 mnib contributors.\n"
+"This is free software, covered by the GNU General Public License.\n"
+"Version %.2f\n\n", VERSION);
+
+    init_GCR_kernels();
+
+    batch = unpack = 0;
+    while ((argc > 1) && (argv[1][0] == '-'))
+    {
+        if (strcmp(argv[1], "-b") == 0)
+            batch = 1;
+        else if (strcmp(argv[1], "-u") == 0)
+            unpack = 1;
+        else
+            usage();
+        argc--;
+        argv++;
+    }
+
+    if (batch)
+    {
+        if (argc < 2) usage();
+        if (unpack)
+            return (run_batch(argc-1, argv+1, ".nbz", ".nib", unpack_nbz));
+        else
+            return (run_batch(argc-1, argv+1, ".nib", ".nbz", pack_nib));
+    }
+
+    if (argc == 2)
+    {
+        strcpy(inname, argv[1]);
+        make_output_name(inname, outname, unpack ? ".nib" : ".nbz");
+    }
+    else if (argc == 3)
+    {
+        strcpy(inname, argv[1]);
+        strcpy(outname, argv[2]);
+    }
+    else usage();
+
+    if (unpack)
+        return (unpack_nbz(inname, outname, &errors));
+    else
+        return (pack_nib(inname, outname, &errors));
+}
@@ -0,0 +1,428 @@
+/* simdrive.c - simulated 1541 drive for the cbm transport layer
+
+    (C) 2026 mnib contributors
+
+    The simulated drive answers the drive side of mnib: the command
+    channel (M-W, M-E and the error channel) and the parallel protocol
+    of the nibbler code in bn_flop.prg.  Tracks come from a NIB, NBZ or
+    G64 image, so mnib can be run, profiled and tested without a drive:
+
+        mnib -tsim:image.g64 output.nib
+
+    NIB and NBZ tracks are played back exactly as they were read.  G64
+    tracks are one revolution, the disk turns on with delays and with
+    the bytes read, so each read starts somewhere else on the track.
+    Halftracks not in the image read as the full track below them,
+    missing tracks read as unformatted.
+
+    V 0.10   first version
+    V 0.11   tracks mnib failed to read are unformatted
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbm.h"
+#include "kernel.h"
+#include "gcr.h"
+#include "image.h"
+
+
+/* floppy commands of the parallel protocol, see mnib.c */
+#define FL_STEPTO      0x00
+#define FL_MOTOR       0x01
+#define FL_RESET       0x02
+#define FL_READNORMAL  0x03
+#define FL_DENSITY     0x05
+#define FL_SCANKILLER  0x06
+#define FL_SCANDENSITY 0x07
+#define FL_READWOSYNC  0x08
+#define FL_TEST        0x0a
+#define FL_VERIFY_CODE 0x10
+
+#define DRIVE_RAM 0x0800
+#define CODE_START 0x0300
+
+/* one revolution at 300 rpm takes 200 ms */
+#define REVOLUTION_MS 200
+
+#define STATUS_OK "00, OK,00,00\r"
+
+
+static struct disk_image image;
+static BYTE ram[DRIVE_RAM];
+static char status[40];         /* error channel */
+static int status_pos;
+
+static int listen_channel;      /* -1 if not listening */
+static int talk_channel;        /* -1 if not talking */
+static BYTE command[64];        /* command channel input */
+static int command_len;
+
+static BYTE par_cmd[8];         /* parallel command and parameters */
+static int par_len;
+static BYTE reply[0x600];       /* parallel bytes to read */
+static int reply_len, reply_pos;
+
+static BYTE via_port = 0x60;    /* $1c00: motor, LED and bitrate */
+static int halftrack = 36;
+static long rotation;           /* position on the G64 track cycle */
+
+static BYTE nib_data[GCR_TRACK_LENGTH];
+static int nib_pos = GCR_TRACK_LENGTH;
+
+
+/* the track under the head, NULL if unformatted */
+static BYTE *head_track(int *track_len, int *density)
+{
+    BYTE *track;
+    int ht;
+
+    ht = halftrack;
+    track = image_track(&image, ht, track_len);
+    if (track == NULL)
+    {
+        ht = halftrack & ~1;
+        track = image_track(&image, ht, track_len);
+    }
+
+    /* a track mnib failed to read is not given back as data */
+    if ((track != NULL) && image_track_failed(&image, ht)) track = NULL;
+    if (track != NULL) *density = image_density(&image, ht);
+    return (track);
+}
+
+
+/* killer info like the floppy code: $80 all sync, $40 no sync */
+static BYTE scan_killer(void)
+{
+    BYTE *track;
+    int track_len, density;
+    int syncs, i;
+
+    track = head_track(&track_len, &density);
+    if (track == NULL) return (0x40);
+
+    for (syncs = 0, i = 0; i < track_len; i++)
+        if (track[i] == 0xff) syncs++;
+    if (syncs == track_len) return (0x80);
+    if (syncs == 0) return (0x40);
+    return (0x00);
+}
+
+
+static void scan_density(void)
+{
+    BYTE *track;
+    int track_len, density;
+    int bin;
+
+    track = head_track(&track_len, &density);
+    for (bin = 3; bin >= 0; bin--)
+        reply[reply_len++] = ((track != NULL) && (scan_killer() == 0)
+                              && ((density & 3) == bin)) ? 60 : 0;
+    reply[reply_len++] = 0;
+}
+
+
+/* fill nib_data with the next 0x2000 bytes read from the track */
+static void read_track(int wait_sync)
+{
+    BYTE *track;
+    int track_len, density;
+    int pos, i;
+
+    nib_pos = 0;
+    track = head_track(&track_len, &density);
+    if (track == NULL)
+    {
+        memset(nib_data, 0x00, GCR_TRACK_LENGTH);
+        return;
+    }
+
+    /* NIB and NBZ tracks are played back as they are */
+    if (image.type != IMAGE_G64)
+    {
+        memcpy(nib_data, track, GCR_TRACK_LENGTH);
+        return;
+    }
+
+    pos = rotation % track_len;
+    if (wait_sync)
+    {
+        for (i = 0; (i < track_len) && (track[pos] != 0xff); i++)
+            pos = (pos + 1) % track_len;
+        for (i = 0; (i < track_len) && (track[pos] == 0xff); i++)
+            pos = (pos + 1) % track_len;
+    }
+    for (i = 0; i < GCR_TRACK_LENGTH; i++)
+    {
+        nib_data[i] = track[pos];
+        pos = (pos + 1) % track_len;
+    }
+    rotation = pos;
+}
+
+
+/* run a complete parallel command */
+static void par_command(void)
+{
+    int i;
+
+    reply_len = reply_pos = 0;
+    switch (par_cmd[4])
+    {
+        case FL_STEPTO:
+            halftrack = par_cmd[5];
+            reply[reply_len++] = 0;
+            break;
+
+        case FL_MOTOR:
+            via_port = (via_port & par_cmd[5]) | par_cmd[6];
+            reply[reply_len++] = 0;
+            break;
+
+        case FL_DENSITY:
+            via_port = (via_port & par_cmd[6]) | par_cmd[7];
+            reply[reply_len++] = 0;
+            break;
+
+        case FL_RESET:
+            memset(ram, 0, sizeof(ram));
+            break;
+
+        case FL_READNORMAL:
+        case FL_READWOSYNC:
+            read_track(par_cmd[4] == FL_READNORMAL);
+            reply[reply_len++] = 0;
+            reply[reply_len++] = 0;
+            break;
+
+        case FL_SCANKILLER:
+            reply[reply_len++] = scan_killer();
+            break;
+
+        case FL_SCANDENSITY:
+            scan_density();
+            break;
+
+        case FL_TEST:
+            for (i = 0; i < 0x100; i++)
+                reply[reply_len++] = i;
+            reply[reply_len++] = 0;
+            break;
+
+        case FL_VERIFY_CODE:
+            for (i = CODE_START; i < DRIVE_RAM; i++)
+                reply[reply_len++] = ram[i];
+            reply[reply_len++] = 0;
+            break;
+    }
+}
+
+
+/* number of parameters of a parallel command */
+static int par_params(BYTE cmd)
+{
+    switch (cmd)
+    {
+        case FL_STEPTO:  return (1);
+        case FL_MOTOR:   return (2);
+        case FL_DENSITY: return (3);
+    }
+    return (0);
+}
+
+
+static void par_write(BYTE byte)
+{
+    static BYTE sync[4] = { 0x00, 0x55, 0xaa, 0xff };
+
+    par_cmd[par_len++] = byte;
+
+    /* wait for the sync bytes in front of each command */
+    if (par_len <= 4)
+    {
+        if (byte != sync[par_len - 1])
+            par_len = (byte == sync[0]) ? 1 : 0;
+        return;
+    }
+    if (par_len == 5 + par_params(par_cmd[4]))
+    {
+        par_command();
+        par_len = 0;
+    }
+}
+
+
+/* run a command sent to channel 15 */
+static void run_command(void)
+{
+    int adr, len;
+
+    strcpy(status, STATUS_OK);
+    status_pos = 0;
+
+    if ((command_len >= 6) && (memcmp(command, "M-W", 3) == 0))
+    {
+        adr = command[3] + (command[4] << 8);
+        len = command[5];
+        if (len > command_len - 6) len = command_len - 6;
+        if (adr + len <= DRIVE_RAM) memcpy(ram + adr, command + 6, len);
+    }
+    else if ((command_len >= 5) && (memcmp(command, "M-E", 3) == 0))
+    {
+        /* LDA #$73: JMP $E6C1 reports the DOS version */
+        adr = command[3] + (command[4] << 8);
+        if ((adr < DRIVE_RAM - 2) && (ram[adr] == 0xa9)
+            && (ram[adr + 1] == 0x73))
+            strcpy(status, "73,CBM DOS V2.6 1541,00,00\r");
+    }
+    command_len = 0;
+}
+
+
+static int sim_init(int reset, char *arg)
+{
+    if (*arg == '\0')
+    {
+        fprintf(stderr, "Use -tsim:image for the simulated drive.\n");
+        return (0);
+    }
+    if (!open_image(&image, arg)) return (0);
+
+    printf("Simulated drive, disk image %s\n", arg);
+    strcpy(status, "73,CBM DOS V2.6 1541,00,00\r");
+    status_pos = 0;
+    listen_channel = talk_channel = -1;
+    return (1);
+}
+
+
+static int sim_set_par_port(int port)
+{
+    if (port != 0) return (0);
+    printf("Port %d: simulated ", port);
+    return (1);
+}
+
+
+static int sim_ioctl(int f, unsigned int cmd, unsigned long arg)
+{
+    int channel;
+
+    channel = arg & 0x0f;
+    switch (cmd)
+    {
+        case CBMCTRL_LISTEN:
+            listen_channel = channel;
+            command_len = 0;
+            return (0);
+
+        case CBMCTRL_UNLISTEN:
+            if (listen_channel == 15) run_command();
+            listen_channel = -1;
+            return (0);
+
+        case CBMCTRL_TALK:
+            talk_channel = channel;
+            return (0);
+
+        case CBMCTRL_UNTALK:
+            talk_channel = -1;
+            return (0);
+
+        case CBMCTRL_PAR_READ:
+            if (reply_pos < reply_len) return (reply[reply_pos++]);
+            return (0);
+
+        case CBMCTRL_PAR_WRITE:
+            par_write(arg & 0xff);
+            return (0);
+    }
+    return (0);
+}
+
+
+static int sim_read(int f, char *buf, int count)
+{
+    int len;
+
+    if (talk_channel != 15) return (0);
+
+    len = strlen(status + status_pos);
+    if (len > count) len = count;
+    memcpy(buf, status + status_pos, len);
+    status_pos += len;
+    if (status[status_pos] == '\0')
+    {
+        strcpy(status, STATUS_OK);
+        status_pos = 0;
+    }
+    return (len);
+}
+
+
+static int sim_write(int f, char *buf, int count)
+{
+    int len;
+
+    if (listen_channel != 15) return (count);
+
+    len = count;
+    if (len > sizeof(command) - command_len)
+        len = sizeof(command) - command_len;
+    memcpy(command + command_len, buf, len);
+    command_len += len;
+    return (count);
+}
+
+
+static int sim_nib_read(int f)
+{
+    if (nib_pos >= GCR_TRACK_LENGTH) return (-1);
+    return (nib_data[nib_pos++]);
+}
+
+
+static int sim_nib_read_track(int f, __u_char *buf, int count)
+{
+    if (count > GCR_TRACK_LENGTH - nib_pos)
+        count = GCR_TRACK_LENGTH - nib_pos;
+    memcpy(buf, nib_data + nib_pos, count);
+    nib_pos += count;
+    return (count);
+}
+
+
+static void sim_delay(int msec)
+{
+    BYTE *track;
+    int track_len, density;
+
+    track = head_track(&track_len, &density);
+    if (track != NULL)
+        rotation += (long) msec * track_len / REVOLUTION_MS;
+}
+
+
+static void sim_nothing(void)
+{
+}
+
+
+struct cbm_transport sim_transport =
+{
+    "sim",
+    sim_init,
+    sim_set_par_port,
+    sim_ioctl,
+    sim_read,
+    sim_write,
+    sim_nib_read,
+    sim_nib_read,
+    sim_nib_read_track,
+    sim_delay,
+    sim_nothing,
+    sim_nothing
+};
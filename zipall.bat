@@ -1,4 +1,6 @@
-pkzip %1 mnib.exe bn_flop.asm bn_flop.prg bn_flop.h n2d.exe n2g.exe g2d.exe
-pkzip %1 mnib.c kernel.c kernel.h cbm.c cbm.h gcr.c gcr.h mn.bat
-pkzip %1 mnd.bat n2g.c n2d.c g2d.c
+pkzip %1 mnib.exe bn_flop.asm bn_flop.prg bn_flop.h n2d.exe n2g.exe g2d.exe nibz.exe nibstore.exe nibdiff.exe nibmerge.exe cbmserve.exe
+pkzip %1 mnib.c kernel.c kernel.h cbm.c cbm.h gcr.c gcr.h gcr_tab.h mkgcrtab.c gcrbench.c mn.bat
+pkzip %1 simdrive.c cbmpipe.c cbmserve.c lptemu.c mn.sh
+pkzip %1 mnd.bat n2g.c n2d.c g2d.c batch.c batch.h image.c image.h nbz.c nbz.h nibz.c
+pkzip %1 extract.c extract.h nibstore.c cache.c cache.h nibdiff.c nibmerge.c jobs.c jobs.h
 pkzip %1 zipnib.bat zipall.bat
@@ -1 +1 @@
-pkzip %1 mnib.exe n2d.exe n2g.exe g2d.exe
+pkzip %1 mnib.exe n2d.exe n2g.exe g2d.exe nibz.exe nibstore.exe nibdiff.exe nibmerge.exe cbmserve.exe